@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <regex>
 
+#include "CaelusStyle.h"
+
 #include "CaelusClass.h"
 
 namespace Caelus
@@ -67,47 +69,9 @@ namespace Caelus
 
     void CaelusClass::SetBorder(std::string_view const & border, Edge const edge)
     {
-        auto toks = mxi::explode(border, " ");
-        bool tokSolid = false;
-        Measure tokMeasure = {};
-        Color tokColor = {};
-
-        for (size_t i = 0; i < toks.size(); ++i)
-        {
-            auto tok = std::string(toks[i]);
-            if (tok.empty()) continue;
-            if (tok == "rgb(")
-            {
-                while (++i < toks.size() && toks[i][tok.size() - 1] != ')')
-                {
-                    tok.append(toks[i]);
-                }
-                tokColor = Color::Parse(tok);
-                continue;
-            }
-
-            if (tok == "solid")
-            {
-                tokSolid = true;
-                continue;
-            }
-
-            try
-            {
-                tokMeasure = Measure::Parse(tok);
-                continue;
-            }
-            catch (...) {};
-
-            try
-            {
-                tokColor = Color::Parse(tok);
-                continue;
-            }
-            catch (...) {};
-
-            MX_THROW(std::format("Unidentified border format token: {}", tok));
-        }
+        auto const parsed = jass::Border::Parse(border);
+        auto const & tokMeasure = parsed.width;
+        auto const & tokColor = parsed.color;
 
         if (edge == Edge::ALL_EDGES)
         {
@@ -274,16 +238,20 @@ namespace Caelus
 
     void CaelusClass::SetPadding(std::string_view const & padding, Edge const edge)
     {
-        auto const m = Measure::Parse(padding);
         if (edge == Edge::ALL_EDGES)
         {
-            static auto const edges = { TOP, LEFT, BOTTOM, RIGHT };
-            for (auto const edge : edges)
+            // 1-4 values, as in CSS
+            auto const values = jass::EdgeValues::Split(padding);
+            auto const set = [this](Edge const edge, std::string_view const & value)
             {
-                if (!m_padding[edge].has_value()) m_padding[edge] = m;
-            }
+                if (!m_padding[edge].has_value()) m_padding[edge] = Measure::Parse(value);
+            };
+            set(TOP, values.top);
+            set(RIGHT, values.right);
+            set(BOTTOM, values.bottom);
+            set(LEFT, values.left);
         }
-        else m_padding[edge] = m;
+        else m_padding[edge] = Measure::Parse(padding);
     }
 
     void CaelusClass::SetParentName(std::string_view const & v)
@@ -301,58 +269,8 @@ namespace Caelus
 
     void CaelusClass::SetTether(Edge const myEdge, std::string_view const & tether)
     {
-        /* Examples
-            left=id.right+5px //explicit sibling
-            left=5px //parent
-            left=+5px // sibling
-        */
-        auto spec = std::string{ mxi::trim(tether) };
-        constexpr static auto const pattern = R"(^(?:([^\.]+)\.(left|right|bottom|top|l|r|t|b))?(?:\s+)?(?:(\+|\-)?(?:\s+)?([0-9]+(?:\.[0-9]+)?)(em|px|%|))?$)";
-        static auto const regex = std::regex(pattern, std::regex_constants::ECMAScript);
-
-        static auto const msgFormat = "Invalid tether: bad format. Expected [id.side][[+|-]offset[px|em|%]], saw {}";
-        static auto const msgEdge = "Invalid tether : incompatible edge axis.";
-
-        auto matches = std::smatch{};
-        if (!std::regex_search(spec, matches, regex))
-        {
-            MX_THROW(std::format(msgFormat, spec).c_str());
-        }
-
-        auto name = matches[1].str();
-        auto const sedge = matches[2].str();
-        auto const sop = matches[3].str();
-        auto const soffset = matches[4].str();
-        auto const sunit = matches[5].str();
-
-        double offset = soffset.empty() ? 0 : atof(soffset.c_str());
-        Edge otherEdge = myEdge;
-
-        if (!name.empty())
-        {
-            // Normal tether
-            otherEdge = keywordToEdge(sedge);
-            if (isHEdge(otherEdge) != isHEdge(otherEdge)) MX_THROW(msgEdge);
-            if (sop.empty() && !soffset.empty())  MX_THROW(std::format(msgFormat, spec).c_str());
-            if (sop == "-") offset = -offset;
-        }
-        else if (sop.empty())
-        {
-            // Absolute within parent
-            if (myEdge == BOTTOM || myEdge == RIGHT) offset = -offset;
-        }
-        else
-        {
-            // Tether to adjacent sibling
-            name = ".";
-            if (myEdge == TOP || myEdge == LEFT) offset = -offset;
-            otherEdge = ~myEdge;
-        }
-
-        auto unit = Unit::PX;
-        if (sunit == "em") unit = EM;
-        else if (sunit == "%") { unit = PC; offset /= 100; }
-        SetTether(myEdge, name, otherEdge, { offset, unit });
+        auto const t = Tether::Parse(myEdge, tether);
+        SetTether(myEdge, t.id, t.edge, t.offset);
     }
 
     void CaelusClass::SetTextAlignH(Edge const edge)
@@ -1,33 +1,44 @@
 #pragma once
 
-#include <unordered_map>
+#include <array>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include <Windows.h>
 
+#include "MxiUtils.h"
+
 namespace Caelus
 {
 
     class Color
     {
     public:
-        Color() {};
-        Color(Color const &) = default;
-        Color(uint32_t rgb) : r(GetBValue(rgb)), g(GetGValue(rgb)), b(GetRValue(rgb)) {};
-        Color(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha = 255) : r(red), g(green), b(blue), a(alpha) {};
-        uint8_t red() const noexcept { return r; };
-        uint8_t green() const noexcept { return g; };
-        uint8_t blue() const noexcept { return b; };
-        uint8_t alpha() const noexcept { return a; };
+        constexpr Color() {};
+        constexpr Color(Color const &) = default;
+        constexpr Color(uint32_t rgb) : r(GetBValue(rgb)), g(GetGValue(rgb)), b(GetRValue(rgb)) {};
+        constexpr Color(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha = 255) : r(red), g(green), b(blue), a(alpha) {};
+        constexpr uint8_t red() const noexcept { return r; };
+        constexpr uint8_t green() const noexcept { return g; };
+        constexpr uint8_t blue() const noexcept { return b; };
+        constexpr uint8_t alpha() const noexcept { return a; };
         void red(uint8_t v) noexcept { r = v; };
         void green(uint8_t v) noexcept { g = v; };
         void blue(uint8_t v) noexcept { b = v; };
         void alpha(uint8_t v) noexcept { a = v; };
-        uint32_t rgb() const noexcept { return RGB(r, g, b); }
+        constexpr uint32_t rgb() const noexcept { return RGB(r, g, b); }
         void rgb(uint32_t rgb) noexcept { r = GetBValue(rgb); g = GetGValue(rgb); b = GetRValue(rgb); }
-        uint32_t argb() const noexcept { return RGB(r, g, b) | a<<24; }
+        constexpr uint32_t argb() const noexcept { return RGB(r, g, b) | a<<24; }
         void argb(uint32_t argb) noexcept { r = GetBValue(argb); g = GetGValue(argb); b = GetRValue(argb); a = HIBYTE(argb >> 16); }
         static Color Parse(std::string_view const & spec);
+        constexpr bool operator==(Color const &) const = default;
+
+        // As Parse, but returns std::nullopt instead of throwing. Usable at compile time.
+        static constexpr std::optional<Color> TryParse(std::string_view spec);
+
+        // Look up a CSS4 color name.
+        static constexpr std::optional<Color> FromName(std::string_view const & name);
 
     private:
         uint8_t r = 0;
@@ -35,4 +46,180 @@ namespace Caelus
         uint8_t b = 0;
         uint8_t a = 255;
     };
+
+    class NamedColor
+    {
+    public:
+        std::string_view name;
+        uint32_t rgb;
+    };
+
+    inline constexpr NamedColor kNamedColors[] = {
+        { "aliceblue", 0xf0f8ff }, { "antiquewhite", 0xfaebd7 }, { "aqua", 0x00ffff }, { "aquamarine", 0x7fffd4 },
+        { "azure", 0xf0ffff }, { "beige", 0xf5f5dc }, { "bisque", 0xffe4c4 }, { "black", 0x000000 },
+        { "blanchedalmond", 0xffebcd }, { "blue", 0x0000ff }, { "blueviolet", 0x8a2be2 }, { "brown", 0xa52a2a },
+        { "burlywood", 0xdeb887 }, { "cadetblue", 0x5f9ea0 }, { "chartreuse", 0x7fff00 }, { "chocolate", 0xd2691e },
+        { "coral", 0xff7f50 }, { "cornflowerblue", 0x6495ed }, { "cornsilk", 0xfff8dc }, { "crimson", 0xdc143c },
+        { "cyan", 0x00ffff }, { "darkblue", 0x00008b }, { "darkcyan", 0x008b8b }, { "darkgoldenrod", 0xb8860b },
+        { "darkgray", 0xa9a9a9 }, { "darkgreen", 0x006400 }, { "darkgrey", 0xa9a9a9 }, { "darkkhaki", 0xbdb76b },
+        { "darkmagenta", 0x8b008b }, { "darkolivegreen", 0x556b2f }, { "darkorange", 0xff8c00 },
+        { "darkorchid", 0x9932cc }, { "darkred", 0x8b0000 }, { "darksalmon", 0xe9967a },
+        { "darkseagreen", 0x8fbc8f }, { "darkslateblue", 0x483d8b }, { "darkslategray", 0x2f4f4f },
+        { "darkslategrey", 0x2f4f4f }, { "darkturquoise", 0x00ced1 }, { "darkviolet", 0x9400d3 },
+        { "deeppink", 0xff1493 }, { "deepskyblue", 0x00bfff }, { "dimgray", 0x696969 }, { "dimgrey", 0x696969 },
+        { "dodgerblue", 0x1e90ff }, { "firebrick", 0xb22222 }, { "floralwhite", 0xfffaf0 },
+        { "forestgreen", 0x228b22 }, { "fuchsia", 0xff00ff }, { "gainsboro", 0xdcdcdc }, { "ghostwhite", 0xf8f8ff },
+        { "gold", 0xffd700 }, { "goldenrod", 0xdaa520 }, { "gray", 0x808080 }, { "green", 0x008000 },
+        { "greenyellow", 0xadff2f }, { "grey", 0x808080 }, { "honeydew", 0xf0fff0 }, { "hotpink", 0xff69b4 },
+        { "indianred", 0xcd5c5c }, { "indigo", 0x4b0082 }, { "ivory", 0xfffff0 }, { "khaki", 0xf0e68c },
+        { "lavender", 0xe6e6fa }, { "lavenderblush", 0xfff0f5 }, { "lawngreen", 0x7cfc00 },
+        { "lemonchiffon", 0xfffacd }, { "lightblue", 0xadd8e6 }, { "lightcoral", 0xf08080 },
+        { "lightcyan", 0xe0ffff }, { "lightgoldenrodyellow", 0xfafad2 }, { "lightgray", 0xd3d3d3 },
+        { "lightgreen", 0x90ee90 }, { "lightgrey", 0xd3d3d3 }, { "lightpink", 0xffb6c1 },
+        { "lightsalmon", 0xffa07a }, { "lightseagreen", 0x20b2aa }, { "lightskyblue", 0x87cefa },
+        { "lightslategray", 0x778899 }, { "lightslategrey", 0x778899 }, { "lightsteelblue", 0xb0c4de },
+        { "lightyellow", 0xffffe0 }, { "lime", 0x00ff00 }, { "limegreen", 0x32cd32 }, { "linen", 0xfaf0e6 },
+        { "magenta", 0xff00ff }, { "maroon", 0x800000 }, { "mediumaquamarine", 0x66cdaa },
+        { "mediumblue", 0x0000cd }, { "mediumorchid", 0xba55d3 }, { "mediumpurple", 0x9370db },
+        { "mediumseagreen", 0x3cb371 }, { "mediumslateblue", 0x7b68ee }, { "mediumspringgreen", 0x00fa9a },
+        { "mediumturquoise", 0x48d1cc }, { "mediumvioletred", 0xc71585 }, { "midnightblue", 0x191970 },
+        { "mintcream", 0xf5fffa }, { "mistyrose", 0xffe4e1 }, { "moccasin", 0xffe4b5 }, { "navajowhite", 0xffdead },
+        { "navy", 0x000080 }, { "oldlace", 0xfdf5e6 }, { "olive", 0x808000 }, { "olivedrab", 0x6b8e23 },
+        { "orange", 0xffa500 }, { "orangered", 0xff4500 }, { "orchid", 0xda70d6 }, { "palegoldenrod", 0xeee8aa },
+        { "palegreen", 0x98fb98 }, { "paleturquoise", 0xafeeee }, { "palevioletred", 0xdb7093 },
+        { "papayawhip", 0xffefd5 }, { "peachpuff", 0xffdab9 }, { "peru", 0xcd853f }, { "pink", 0xffc0cb },
+        { "plum", 0xdda0dd }, { "powderblue", 0xb0e0e6 }, { "purple", 0x800080 }, { "rebeccapurple", 0x663399 },
+        { "red", 0xff0000 }, { "rosybrown", 0xbc8f8f }, { "royalblue", 0x4169e1 }, { "saddlebrown", 0x8b4513 },
+        { "salmon", 0xfa8072 }, { "sandybrown", 0xf4a460 }, { "seagreen", 0x2e8b57 }, { "seashell", 0xfff5ee },
+        { "sienna", 0xa0522d }, { "silver", 0xc0c0c0 }, { "skyblue", 0x87ceeb }, { "slateblue", 0x6a5acd },
+        { "slategray", 0x708090 }, { "slategrey", 0x708090 }, { "snow", 0xfffafa }, { "springgreen", 0x00ff7f },
+        { "steelblue", 0x4682b4 }, { "tan", 0xd2b48c }, { "teal", 0x008080 }, { "thistle", 0xd8bfd8 },
+        { "tomato", 0xff6347 }, { "turquoise", 0x40e0d0 }, { "violet", 0xee82ee }, { "wheat", 0xf5deb3 },
+        { "white", 0xffffff }, { "whitesmoke", 0xf5f5f5 }, { "yellow", 0xffff00 }, { "yellowgreen", 0x9acd32 }
+    };
+
+    // Named colors are found through a perfect hash: with this seed every name lands in its own slot
+    // of a 1024-entry table. Building kNamedColorSlots fails to compile if that ever stops being true.
+    inline constexpr uint32_t kNamedColorSeed = 113035;
+    inline constexpr size_t kNamedColorBits = 10;
+    inline constexpr uint8_t kNoNamedColor = 0xFF;
+    static_assert(std::size(kNamedColors) < kNoNamedColor);
+
+    constexpr size_t HashColorName(std::string_view const & name)
+    {
+        auto h = uint32_t{ 2166136261 } ^ kNamedColorSeed;
+        for (auto const c : name)
+        {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619;
+        }
+        return h >> (32 - kNamedColorBits);
+    }
+
+    inline constexpr auto kNamedColorSlots = []
+    {
+        auto slots = std::array<uint8_t, size_t{ 1 } << kNamedColorBits>{};
+        slots.fill(kNoNamedColor);
+        for (size_t i = 0; i < std::size(kNamedColors); ++i)
+        {
+            auto & slot = slots[HashColorName(kNamedColors[i].name)];
+            if (slot != kNoNamedColor) throw "kNamedColorSeed no longer hashes every color name to its own slot";
+            slot = static_cast<uint8_t>(i);
+        }
+        return slots;
+    }();
+
+    constexpr std::optional<Color> Color::FromName(std::string_view const & name)
+    {
+        auto const slot = kNamedColorSlots[HashColorName(name)];
+        if (slot == kNoNamedColor || kNamedColors[slot].name != name) return std::nullopt;
+        return Color{ kNamedColors[slot].rgb };
+    }
+
+    constexpr std::optional<Color> Color::TryParse(std::string_view spec)
+    {
+        auto const isSpace = [](char const c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+        auto const lower = [](char const c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; };
+        while (!spec.empty() && isSpace(spec.front())) spec.remove_prefix(1);
+        while (!spec.empty() && isSpace(spec.back())) spec.remove_suffix(1);
+
+        if (auto const named = FromName(spec)) return named;
+
+        auto pos = size_t{ 0 };
+        auto const skipSpace = [&]() { while (pos < spec.size() && isSpace(spec[pos])) ++pos; };
+        auto const skipSeparator = [&]()
+        {
+            skipSpace();
+            if (pos < spec.size() && spec[pos] == ',') ++pos;
+            skipSpace();
+        };
+        uint8_t rgb[3] = {};
+
+        // #RRGGBB or 0xRRGGBB, optionally spaced or comma separated
+        if (spec.starts_with('#') || (spec.size() >= 2 && spec[0] == '0' && lower(spec[1]) == 'x'))
+        {
+            auto const hex = [&](char const c) -> int
+            {
+                auto const l = lower(c);
+                if (l >= '0' && l <= '9') return l - '0';
+                if (l >= 'a' && l <= 'f') return l - 'a' + 10;
+                return -1;
+            };
+            pos = (spec[0] == '#') ? 1 : 2;
+            for (int i = 0; i < 3; ++i)
+            {
+                if (i) skipSeparator();
+                else skipSpace();
+                if (pos + 2 > spec.size()) return std::nullopt;
+                auto const hi = hex(spec[pos]);
+                auto const lo = hex(spec[pos + 1]);
+                if (hi < 0 || lo < 0) return std::nullopt;
+                rgb[i] = static_cast<uint8_t>(hi * 16 + lo);
+                pos += 2;
+            }
+            if (pos != spec.size()) return std::nullopt;
+            return Color{ rgb[0], rgb[1], rgb[2] };
+        }
+
+        // rgb(rrr,ggg,bbb) or rgb(N.F[%],N.F[%],N.F[%])
+        if (spec.size() < 3 || lower(spec[0]) != 'r' || lower(spec[1]) != 'g' || lower(spec[2]) != 'b') return std::nullopt;
+        pos = 3;
+        skipSpace();
+        if (pos < spec.size() && spec[pos] == '(') ++pos;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (i) skipSeparator();
+            else skipSpace();
+            auto const start = pos;
+            auto const number = mxi::scan_decimal(spec, pos);
+            if (!number) return std::nullopt;
+            auto component = number.value();
+            if (pos < spec.size() && spec[pos] == '%')
+            {
+                ++pos;
+                component = (component / 100.0) * 255.0;
+            }
+            else if (spec.substr(start, pos - start).find('.') != std::string_view::npos)
+            {
+                component *= 255.0;
+            }
+            if (component > 255.0) return std::nullopt;
+            rgb[i] = static_cast<uint8_t>(component);
+        }
+        skipSpace();
+        if (pos < spec.size() && spec[pos] == ')') ++pos;
+        if (pos != spec.size()) return std::nullopt;
+        return Color{ rgb[0], rgb[1], rgb[2] };
+    }
+
+    inline namespace literals
+    {
+        // "#ff8800"_color, "rgb(255,136,0)"_color or "orange"_color; malformed literals fail to compile.
+        consteval Color operator""_color(char const * s, size_t const n)
+        {
+            auto const color = Color::TryParse({ s, n });
+            if (!color) throw "Invalid color literal";
+            return color.value();
+        }
+    }
 }
\ No newline at end of file
@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <format>
+#include <iterator>
+
 #include "MxiLogging.h"
 #include "MxiUtils.h"
 
@@ -124,16 +130,19 @@ namespace Caelus
     void CaelusElement::SetBorderColor(Color const & color)
     {
         m_class->SetBorderColor(color);
+        InvalidateStyle();
     }
 
     void CaelusElement::SetBorderColor(std::string_view const & color)
     {
         m_class->SetBorderColor(color);
+        InvalidateStyle();
     }
 
     void CaelusElement::SetLabel(std::string_view const & label)
     {
         m_class->SetLabel(label);
+        InvalidateStyle();
     }
 
     void CaelusElement::SetSize(std::string_view const & width, std::string_view const & height)
@@ -143,6 +152,75 @@ namespace Caelus
     }
 
 
+    void CaelusElement::AddClass(std::string_view const & name)
+    {
+        auto const atom = mxi::intern(name);
+        auto const pos = std::lower_bound(m_classes.begin(), m_classes.end(), atom);
+        if (pos != m_classes.end() && *pos == atom) return;
+        m_classes.insert(pos, atom);
+        ScheduleRestyle(GetWindow()->m_invalidationSets.ForClass(atom));
+    }
+
+    void CaelusElement::RemoveClass(std::string_view const & name)
+    {
+        auto const atom = mxi::find_atom(name);
+        auto const pos = std::lower_bound(m_classes.begin(), m_classes.end(), atom);
+        if (!atom || pos == m_classes.end() || *pos != atom) return;
+        m_classes.erase(pos);
+        ScheduleRestyle(GetWindow()->m_invalidationSets.ForClass(atom));
+    }
+
+    void CaelusElement::SetAttribute(std::string_view const & name, std::string_view const & value)
+    {
+        static auto const kId = mxi::intern("id");
+        static auto const kClass = mxi::intern("class");
+        static auto const kStyle = mxi::intern("style");
+        auto & window = *GetWindow();
+        auto const & sets = window.m_invalidationSets;
+        auto const atom = mxi::intern(name);
+        m_attributes.Set(atom, value);
+
+        auto invalidation = sets.ForAttribute(atom);
+        if (atom == kId)
+        {
+            auto const id = mxi::intern(value);
+            invalidation |= sets.ForId(m_id) | sets.ForId(id);
+            window.UnindexElement(*this);
+            m_id = id;
+            window.IndexElement(*this);
+        }
+        else if (atom == kClass)
+        {
+            // Only the classes gained or lost matter
+            auto const before = m_classes;
+            SetClasses(value);
+            auto changed = std::vector<mxi::Atom>{};
+            std::set_symmetric_difference(before.begin(), before.end(), m_classes.begin(), m_classes.end(), std::back_inserter(changed));
+            for (auto const c : changed) invalidation |= sets.ForClass(c);
+        }
+        else if (atom == kStyle)
+        {
+            ParseStyleAttribute();
+            invalidation |= INVALIDATE_SELF;
+        }
+        ScheduleRestyle(invalidation);
+    }
+
+    void CaelusElement::SetClasses(std::string_view const & classes)
+    {
+        static constexpr auto const kWhitespace = std::string_view{ " \t\r\n" };
+        m_classes.clear();
+        for (auto pos = classes.find_first_not_of(kWhitespace); pos != std::string_view::npos; pos = classes.find_first_not_of(kWhitespace, pos))
+        {
+            auto const end = (std::min)(classes.find_first_of(kWhitespace, pos), classes.size());
+            m_classes.push_back(mxi::intern(classes.substr(pos, end - pos)));
+            pos = end;
+        }
+        std::sort(m_classes.begin(), m_classes.end());
+        m_classes.erase(std::unique(m_classes.begin(), m_classes.end()), m_classes.end());
+    }
+
+
     // =-=-=-=-=-=-=-=-= Element arrangement =-=-=-=-=-=-=-=-=
 
     CaelusElement::CaelusElement(std::string_view const & name) : m_name(std::string{ name })
@@ -153,25 +231,41 @@ namespace Caelus
     CaelusElement * CaelusElement::AppendChild(std::string_view const & name)
     {
         if (name.find_first_of(". ") != std::string::npos) MX_THROW("Element names cannot contain '.' or ' '.");
-        auto ep = std::make_shared<CaelusElement>(CaelusElement{ name });
-        m_children.push_back(ep);
-        return ep.get();
+        auto & window = *GetWindow();
+        auto const child = window.m_arena.Create(name);
+        LinkChild(child);
+        window.IndexElement(*child);
+        ChildrenChanged();
+        return child;
     }
 
     CaelusElement * CaelusElement::FindElement(std::string_view const & name)
     {
         if (m_name == name) return this;
-        for (auto const & child : m_children)
+        auto const [first, last] = GetWindow()->m_elementsByName.equal_range(name);
+        for (auto it = first; it != last; ++it)
         {
-            auto const found = child.get()->FindElement(name);
-            if (found) return found;
+            if (Contains(*it->second)) return it->second;
         }
         return nullptr;
     }
 
+    bool CaelusElement::Contains(CaelusElement const & element) const noexcept
+    {
+        if (!m_parent) return true; // the window
+        for (auto e = &element; e; e = e->m_parent)
+        {
+            if (e == this) return true;
+        }
+        return false;
+    }
+
     CaelusElement * CaelusElement::GetChild(size_t const n) const noexcept
     {
-        return (m_children.size() > n) ? m_children[n].get() : nullptr;
+        if (n >= m_childCount) return nullptr;
+        auto child = m_firstChild;
+        while (child->IsText() || child->m_index != n) child = child->m_nextSibling;
+        return child;
     }
 
     HWND CaelusElement::GetHwnd() const noexcept
@@ -181,9 +275,12 @@ namespace Caelus
 
     CaelusElement * CaelusElement::InsertChild(std::string_view const & name, size_t n)
     {
-        auto ep = std::make_shared<CaelusElement>(CaelusElement{ name });
-        m_children.insert(std::next(m_children.begin(), n), ep);
-        return ep.get();
+        auto & window = *GetWindow();
+        auto const child = window.m_arena.Create(name);
+        LinkChild(child, GetChild(n));
+        window.IndexElement(*child);
+        ChildrenChanged();
+        return child;
     }
 
     CaelusElement * CaelusElement::GetParent() noexcept
@@ -193,29 +290,26 @@ namespace Caelus
 
     CaelusElement * CaelusElement::GetSibling(std::string_view const & name) const
     {
-        for (auto const & sibling : m_parent->m_children)
-        {
-            if (sibling.get()->m_name == name) return sibling.get();
-        }
-        return nullptr;
+        auto const & siblings = m_parent->m_childNames;
+        if (!siblings) return nullptr;
+        auto const found = siblings->find(name);
+        return (found != siblings->end()) ? found->second : nullptr;
     }
 
     CaelusElement * CaelusElement::GetSibling(Edge const edge) const
     {
-        for (size_t i = 0; i < m_parent->m_children.size(); ++i)
+        if (!m_prevSibling || !m_nextSibling)
         {
-            auto & sibling = m_parent->m_children[i];
-            if (sibling.get() == this)
-            {
-                if (i == 0 || i == m_parent->m_children.size() - 1)
-                {
-                    return m_parent;
-                }
-                if (isFarEdge(edge)) return m_parent->m_children[++i].get();
-                return m_parent->m_children[--i].get();
-            }
+            return m_parent;
         }
-        return m_parent;
+        return isFarEdge(edge) ? m_nextSibling : m_prevSibling;
+    }
+
+    CaelusElement const * CaelusElement::GetPreviousSibling() const noexcept
+    {
+        auto sibling = m_prevSibling;
+        while (sibling && sibling->IsText()) sibling = sibling->m_prevSibling;
+        return sibling;
     }
 
     CaelusWindow const * CaelusElement::GetWindow() const
@@ -225,70 +319,153 @@ namespace Caelus
         return (CaelusWindow *)window;
     }
 
+    CaelusWindow * CaelusElement::GetWindow()
+    {
+        auto window = this;
+        while (window->m_parent) { window = window->m_parent; }
+        return (CaelusWindow *)window;
+    }
+
     void CaelusElement::Remove()
     {
-        RemoveChildren();
         if (!m_parent) MX_THROW("Element::Remove called on Window");
-        for (size_t n = 0; n < m_parent->m_children.size(); ++n)
-        {
-            if (m_parent->m_children[n].get() == this)
-            {
-                m_parent->RemoveChild(n);
-                return;
-            }
-        }
+        if (IsText()) MX_THROW("Element::Remove called on a text node"); // which has no index of its own
+        m_parent->RemoveChild(m_index);
     }
 
     void CaelusElement::RemoveChild(size_t const n)
     {
-        m_children.erase(std::next(m_children.begin(), n));
+        auto const child = GetChild(n);
+        if (!child) MX_THROW(std::format("Element {} has no child {}", m_name, n));
+        auto & window = *GetWindow();
+        window.UnindexTree(*child);
+        child->CancelRestyles(window);
+        child->DestroyChildren(window.m_arena);
+        UnlinkChild(child);
+        window.m_arena.Destroy(child);
+        window.m_styleSharing.Clear(); // entries may be keyed on a destroyed element's style, whose slot is reused
+        ChildrenChanged();
     }
 
     void CaelusElement::RemoveChildren()
     {
-        m_children.clear();
+        if (!m_firstChild) return;
+        auto & window = *GetWindow();
+        for (auto & child : Children())
+        {
+            window.UnindexTree(child);
+            child.CancelRestyles(window);
+        }
+        DestroyChildren(window.m_arena);
+        window.m_styleSharing.Clear(); // as in RemoveChild
+        ChildrenChanged();
     }
 
-    CaelusElement const * CaelusElement::find(size_t uid) const
+    void CaelusElement::DestroyChildren(ElementArena & arena) noexcept
     {
-        auto stack = std::vector<CaelusElement const *>{ this };
-        while (!stack.empty())
+        // From the back, so unlinking never renumbers
+        while (auto const child = m_lastChild)
         {
-            auto const parent = stack.back();
-            stack.pop_back();
-            for (auto const & child : parent->children)
-            {
-                if (child.uid == uid) return &child;
-                if (child.children.size()) stack.push_back(&child);
-            }
+            child->DestroyChildren(arena);
+            UnlinkChild(child);
+            arena.Destroy(child);
         }
-        return nullptr;
+    }
+
+    void CaelusElement::LinkChild(CaelusElement * const child, CaelusElement * const next) noexcept
+    {
+        child->m_parent = this;
+        child->m_nextSibling = next;
+        child->m_prevSibling = next ? next->m_prevSibling : m_lastChild;
+        if (child->m_prevSibling) child->m_prevSibling->m_nextSibling = child;
+        else m_firstChild = child;
+        if (next) next->m_prevSibling = child;
+        else m_lastChild = child;
+        if (!child->IsText()) ++m_childCount;
+        ReindexChildren(child);
+    }
+
+    void CaelusElement::UnlinkChild(CaelusElement * const child) noexcept
+    {
+        auto const next = child->m_nextSibling;
+        if (child->m_prevSibling) child->m_prevSibling->m_nextSibling = next;
+        else m_firstChild = next;
+        if (next) next->m_prevSibling = child->m_prevSibling;
+        else m_lastChild = child->m_prevSibling;
+        child->m_parent = child->m_prevSibling = child->m_nextSibling = nullptr;
+        if (!child->IsText()) --m_childCount;
+        ReindexChildren(next);
+    }
+
+    void CaelusElement::ReindexChildren(CaelusElement * const first) noexcept
+    {
+        if (!first) return;
+        auto const prev = first->m_prevSibling;
+        auto n = !prev ? 0 : prev->IsText() ? prev->m_index : prev->m_index + 1;
+        for (auto child = first; child; child = child->m_nextSibling)
+        {
+            child->m_index = n;
+            if (!child->IsText()) ++n;
+        }
+    }
+
+    void CaelusElement::ChildrenChanged()
+    {
+        // Positions have shifted, so sibling combinators and structural pseudo-classes may match differently
+        auto const & window = *GetWindow();
+        if (window.m_positionalRules) MarkDescendantsForRestyle(window);
+    }
+
+    void ElementArena::Destroy(CaelusElement * const element) noexcept
+    {
+        element->~CaelusElement();
+        m_free.push_back(element);
+    }
+
+    void * ElementArena::Allocate()
+    {
+        if (!m_free.empty())
+        {
+            auto const slot = m_free.back();
+            m_free.pop_back();
+            return slot;
+        }
+        if (m_blocks.empty() || m_used == kBlockSize)
+        {
+            m_blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(kBlockSize * sizeof(CaelusElement)));
+            m_used = 0;
+        }
+        return m_blocks.back().get() + sizeof(CaelusElement) * m_used++;
     }
 
     CaelusElement const * CaelusElement::find(std::string_view const & search) const
     {
         if (search.empty()) return nullptr;
-        auto const c = search[0];
+        if (search[0] == '.') MX_THROW("Search on classes unsupported");
+
+        // Atoms that were never interned cannot be on any element
+        auto const atom = mxi::find_atom((search[0] == '#') ? search.substr(1) : search);
+        if (!atom) return nullptr;
+
+        if (search[0] == '#')
+        {
+            auto const [first, last] = GetWindow()->m_elementsById.equal_range(atom);
+            for (auto it = first; it != last; ++it)
+            {
+                if (it->second != this && Contains(*it->second)) return it->second;
+            }
+            return nullptr;
+        }
+
         auto stack = std::vector<CaelusElement const *>{ this };
         while (!stack.empty())
         {
             auto const parent = stack.back();
             stack.pop_back();
-            for (auto const & child : parent->children)
+            for (auto const & child : parent->Children())
             {
-                switch (c)
-                {
-                case '#':
-                    if (child.attributes.contains("id") && child.attributes.at("id") == search) return &child;
-                    break;
-                case '.':
-                    MX_THROW("Search on classes unsupported");
-                    break;
-                default:
-                    if (child.type == search) return &child;
-                    break;
-                }
-                if (child.children.size()) stack.push_back(&child);
+                if (child.m_tagname == atom) return &child;
+                if (child.m_firstChild) stack.push_back(&child);
             }
         }
         return nullptr;
@@ -533,21 +710,43 @@ namespace Caelus
         return that->WndProc(hwnd, msg, wparam, lparam);
     }
 
-    void CaelusElement::Build()
+    void CaelusElement::ParseStyleAttribute()
     {
-        if (m_attributes.contains("style"))
+        static auto const kStyle = mxi::intern("style");
+        auto parsed = jass::Declarations{};
+        if (m_attributes.Has(kStyle))
         {
-            auto const styles = mxi::explode(m_attributes["style"], ";");
-            for (auto const style : styles)
+            auto const & window = *GetWindow();
+            auto const styles = m_attributes.Get(kStyle);
+            for (size_t pos = 0; pos < styles.size();)
             {
-                auto const parts = mxi::explode(style, ":", 2);
-                auto const k = mxi::trim(parts[0]);
-                auto const v = mxi::trim(parts[1]);
-                m_styles.emplace(k, v);
+                auto const end = (std::min)(styles.find(';', pos), styles.size());
+                auto const style = styles.substr(pos, end - pos);
+                pos = end + 1;
+                auto const colon = style.find(':');
+                if (colon == std::string_view::npos) continue;
+                auto const k = FindProperty(mxi::trim(style.substr(0, colon)));
+                if (!k) continue;
+                auto const v = mxi::trim(style.substr(colon + 1));
+                auto const [line, col] = window.Locate(v);
+                try
+                {
+                    parsed.Parse(k.value(), Property{ v, line, col });
+                }
+                catch (std::exception const & e)
+                {
+                    MX_THROW(std::format("Invalid style attribute at {},{}: \"{}\": {}", line, col, style, e.what()));
+                }
             }
         }
+        m_styles = std::move(parsed);
+    }
+
+    void CaelusElement::Build()
+    {
+        ParseStyleAttribute();
 
-        for (auto child : m_children)
+        for (auto & child : Children())
         {
             child.Build();
         }
@@ -570,9 +769,6 @@ namespace Caelus
         ComputeSize(dim);
         if (m_futureRect.HasEdge(edge)) return RESOLVED;
 
-        auto const position = GetCssProp(kPosition);
-        auto const offset = GetCssProp(GetEdgeProp(edge));
-
         auto const & optTether = GetTether(edge);
         if (!optTether.has_value() && isFarEdge(edge)) return UNRESOLVED;
         auto const tether = optTether.has_value() ? optTether.value() : GetDefaultTether(edge);
@@ -623,9 +819,9 @@ namespace Caelus
         unresolved += ComputeEdge(RIGHT);
         unresolved += ComputeSize(WIDTH);
         unresolved += ComputeSize(HEIGHT);
-        for (auto & child : m_children)
+        for (auto & child : Children())
         {
-            unresolved += child.get()->ComputeLayout();
+            unresolved += child.ComputeLayout();
         }
         return unresolved;
     }
@@ -678,13 +874,12 @@ namespace Caelus
         {
             furthestCoord = getLineHeight(GetHfont());
         }
-        for (auto & cp : m_children)
+        for (auto const & child : Children())
         {
-            auto child = cp.get();
-            if (!child->m_futureRect.HasEdge(farEdge)) return UNRESOLVED;
-            auto farCoord = child->m_futureRect.GetEdge(farEdge);
+            if (!child.m_futureRect.HasEdge(farEdge)) return UNRESOLVED;
+            auto farCoord = child.m_futureRect.GetEdge(farEdge);
             // Far margin, if any
-            auto const & optChildTether = child->GetTether(farEdge);
+            auto const & optChildTether = child.GetTether(farEdge);
             if (optChildTether.has_value())
             {
                 auto const & childTether = optChildTether.value();
@@ -699,9 +894,9 @@ namespace Caelus
     void CaelusElement::PrepareToComputeLayout()
     {
         m_futureRect = {};
-        for (auto & child : m_children)
+        for (auto & child : Children())
         {
-            child.get()->PrepareToComputeLayout();
+            child.PrepareToComputeLayout();
         }
     }
 
@@ -729,9 +924,9 @@ namespace Caelus
             );
         }
 
-        for (auto & child : m_children)
+        for (auto & child : Children())
         {
-            hdwp = child.get()->CommitLayout(hInstance, hdwp);
+            hdwp = child.CommitLayout(hInstance, hdwp);
         }
 
         return hdwp;
@@ -834,98 +1029,308 @@ namespace Caelus
         MX_THROW("Unsupported unit for conversion to pixels.");
     }
 
-    std::string const & CaelusElement::GetCssProp(char const * const property) const
+    ComputedStyle const & CaelusElement::GetComputedStyle() const
     {
-        // Important rules
         auto const window = GetWindow();
-        uint64_t score = 0;
-        jass::Rule const * best = nullptr;
-        for (auto const rule : window->m_rules)
-        {
-            if (!rule.styles.contains(property)) continue;
-            if (!rule.styles.at(property).m_important) continue;
-            auto specificity = GetCssRuleSpecificity(rule);
-            if (specificity > score)
-            {
-                best = &rule;
-                score = specificity;
-            }
-        }
-        if (best) return best->styles.at(property).m_value;
+        auto const generation = window->m_styleGeneration;
 
-        // Inline
-        if (m_styles.contains(property)) return m_styles.at(property);
+        // A pending restyle above us may change what we inherit
+        if (window->m_pendingRestyles && m_parent) m_parent->GetComputedStyle();
+        if (m_style.generation != generation || m_needsRestyle) ComputeStyle(generation);
+        return m_style;
+    }
 
-        // Normal rules
-        auto const window = GetWindow();
-        uint64_t score = 0;
-        jass::Rule const * best = nullptr;
-        for (auto const rule : window->m_rules)
-        {
-            if (!rule.styles.contains(property)) continue;
-            if (rule.styles.at(property).m_important) continue;
-            auto specificity = GetCssRuleSpecificity(rule);
-            if (specificity > score)
+    void CaelusElement::InvalidateStyle()
+    {
+        GetWindow()->InvalidateStyles();
+    }
+
+    void CaelusElement::ScheduleRestyle(uint8_t const invalidation)
+    {
+        if (invalidation == INVALIDATE_NONE) return;
+        auto const & window = *GetWindow();
+        if (invalidation & INVALIDATE_SELF) MarkForRestyle(window);
+        if (invalidation & INVALIDATE_DESCENDANTS) MarkDescendantsForRestyle(window);
+        if (m_parent && (invalidation & (INVALIDATE_SIBLINGS | INVALIDATE_SIBLING_DESCENDANTS)))
+        {
+            for (auto sibling = m_nextSibling; sibling; sibling = sibling->m_nextSibling)
             {
-                best = &rule;
-                score = specificity;
+                if (invalidation & INVALIDATE_SIBLINGS) sibling->MarkForRestyle(window);
+                if (invalidation & INVALIDATE_SIBLING_DESCENDANTS) sibling->MarkDescendantsForRestyle(window);
             }
         }
-        if (best) return best->styles.at(property).m_value;
+    }
 
-        // TODO inherit
+    void CaelusElement::MarkForRestyle(CaelusWindow const & window) const
+    {
+        if (m_needsRestyle) return;
+        m_needsRestyle = true;
+        ++window.m_pendingRestyles;
+        window.m_styleSharing.Clear();
+        for (auto ancestor = m_parent; ancestor && !ancestor->m_childNeedsRestyle; ancestor = ancestor->m_parent)
+        {
+            ancestor->m_childNeedsRestyle = true;
+        }
+    }
 
-        // TODO defaults
+    void CaelusElement::MarkDescendantsForRestyle(CaelusWindow const & window) const
+    {
+        for (auto const & child : Children())
+        {
+            child.MarkForRestyle(window);
+            child.MarkDescendantsForRestyle(window);
+        }
     }
 
-    bool CaelusElement::MatchesSimpleSelector(Selector const & simple) const
+    void CaelusElement::CancelRestyles(CaelusWindow const & window) const noexcept
     {
-        if (!simple.id.empty() && m_id != simple.id) return false;
-        for (auto const & c : simple.classes)
+        // Otherwise the pending count never drains and GetComputedStyle keeps walking ancestors
+        if (m_needsRestyle)
         {
-            if (std::find(m_classes.begin(), m_classes.end(), c) == m_classes.end()) return false;
+            m_needsRestyle = false;
+            --window.m_pendingRestyles;
         }
-        if (!simple.type.empty() && simple.type != m_tagname) return false;
+        for (auto const & child : Children())
+        {
+            child.CancelRestyles(window);
+        }
+    }
 
-        // TODO attributes, pseudoclasses
+    void CaelusElement::ResolveStyles(AncestorFilter & filter, uint64_t const generation, bool const full)
+    {
+        if (m_style.generation != generation || m_needsRestyle) ComputeStyle(generation, &filter);
+
+        // After InvalidateStyles every element is stale; otherwise only marked subtrees need visiting
+        if (!full && !m_childNeedsRestyle) return;
+        m_childNeedsRestyle = false;
+        if (!m_firstChild) return;
+        filter.PushElement(m_tagname, m_id, m_classes);
+        for (auto & child : Children())
+        {
+            child.ResolveStyles(filter, generation, full);
+        }
+        filter.PopElement(m_tagname, m_id, m_classes);
+    }
 
-        switch (simple.combinator)
+    void CaelusElement::ComputeStyle(uint64_t const generation, AncestorFilter * filter) const
+    {
+        auto const window = GetWindow();
+        ++window->m_restyleCount;
+        if (m_needsRestyle)
         {
-        case Combinator::CHILD:
-            return m_parent && m_parent->MatchesSimpleSelector(simple.parent);
+            m_needsRestyle = false;
+            --window->m_pendingRestyles;
+        }
 
-        case Combinator::DESCENDANT:
-            auto cur = this;
-            while (cur = cur->m_parent)
+        // Without an id or positional rules, an element styles exactly like an earlier sibling with the same key
+        auto sharingKey = std::optional<StyleSharingCache::Key>{};
+        if (m_parent && !m_id && !window->m_positionalRules)
+        {
+            sharingKey = StyleSharingCache::Key{ &m_parent->GetComputedStyle(), m_class, m_tagname, m_classes, GetAttributeHash() };
+            if (auto const shared = window->m_styleSharing.Find(sharingKey.value(), generation))
             {
-                if (cur->MatchesSimpleSelector(simple.parent)) return true;
+                if (m_style.generation == generation && !m_style.InheritsSameAs(*shared)) MarkDescendantsForRestyle(*window);
+                m_style = *shared;
+                return;
             }
-            return false;
+        }
 
-        case Combinator::NEXT_SIBLING:
-            auto cur = GetSibling(Edge::LEFT);
-            return cur && cur->MatchesSimpleSelector(simple.parent);
+        auto style = ComputedStyle{};
+        if (m_parent) style.Inherit(m_parent->GetComputedStyle());
 
-        case Combinator::SUBSEQUENT_SIBLING:
-            auto cur = this;
-            while (cur = cur->GetSibling(Edge::LEFT))
+        // Match each candidate rule once, keeping the best specificity of its matching selectors
+        auto candidates = std::vector<RuleIndex::Entry const *>{};
+        for (auto const & sheet : window->m_styleSheets)
+        {
+            // Each sheet appends in its own source order, and sheets are in cascade order
+            sheet->GetIndex().GetCandidates(m_tagname, m_id, m_classes, m_attributes.GetNames(), candidates);
+        }
+        auto matched = std::vector<std::pair<uint64_t, Rule const *>>{};
+        auto const profiler = window->m_profiler.get();
+        for (auto const entry : candidates)
+        {
+            if (filter && filter->FastReject(entry->ancestorHashes))
+            {
+                if (profiler) profiler->RecordFiltered(*entry->rule);
+                continue;
+            }
+            auto const started = profiler ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+            auto const specificity = GetCssRuleSpecificity(*entry);
+            if (profiler)
             {
-                if (cur->MatchesSimpleSelector(simple.parent)) return true;
+                auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started);
+                profiler->RecordAttempt(*entry->rule, specificity.has_value(), static_cast<uint64_t>(elapsed.count()));
             }
-            return false;
+            if (!specificity.has_value()) continue;
+            if (!matched.empty() && matched.back().second == entry->rule)
+            {
+                matched.back().first = (std::max)(matched.back().first, specificity.value());
+                continue;
+            }
+            matched.push_back({ specificity.value(), entry->rule });
+        }
+
+        // Candidates are in source order, so a stable sort leaves later rules winning ties
+        std::stable_sort(matched.begin(), matched.end(), [](auto const & a, auto const & b) { return a.first < b.first; });
+
+        // Normal rules, then class styles, then inline, then important rules
+        auto const apply = [&](PropertyId const prop, Property const & property) { style.Apply(prop, property.m_typed); };
+        for (auto const & [specificity, rule] : matched)
+        {
+            rule->styles.ForEach(~rule->styles.GetImportantMask(), apply);
+        }
+        if (m_class) style.ApplyClass(*m_class);
+        m_styles.ForEach(~m_styles.GetImportantMask(), apply);
+        for (auto const & [specificity, rule] : matched)
+        {
+            rule->styles.ForEach(rule->styles.GetImportantMask(), apply);
+        }
+        m_styles.ForEach(m_styles.GetImportantMask(), apply);
+
+        style.generation = generation;
+        if (sharingKey) window->m_styleSharing.Insert(std::move(sharingKey.value()), style);
+
+        // Children inherit from us, so a changed inherited value must reach them too
+        if (m_style.generation == generation && !m_style.InheritsSameAs(style)) MarkDescendantsForRestyle(*window);
+        m_style = std::move(style);
+    }
 
+    uint64_t CaelusElement::GetAttributeHash() const
+    {
+        // Order-independent, as attributes may be set in any order
+        auto hash = uint64_t{ 0 };
+        auto const & names = m_attributes.GetNames();
+        for (size_t n = 0; n < names.size(); ++n)
+        {
+            hash += (uint64_t{ names[n] } * 0x9E3779B97F4A7C15ULL) ^ m_attributes.GetHash(n);
         }
+        return hash;
+    }
 
+    bool CaelusElement::MatchesCompound(Selector const & compound) const
+    {
+        if (compound.id && m_id != compound.id) return false;
+        if (compound.type && compound.type != m_tagname) return false;
+        if (!std::includes(m_classes.begin(), m_classes.end(), compound.classes.begin(), compound.classes.end())) return false;
+        for (auto const & position : compound.positions)
+        {
+            if (!m_parent || !position.Matches(m_index, m_parent->m_childCount)) return false;
+        }
+        for (auto const & attribute : compound.attributeMatchers)
+        {
+            auto const n = m_attributes.Find(attribute.name);
+            if (n == AttributeTable::npos || !attribute.Matches(m_attributes.GetValue(n), m_attributes.GetHash(n))) return false;
+        }
         return true;
     }
 
-    uint64_t CaelusElement::GetCssRuleSpecificity(Rule const & rule) const
+    size_t AttributeTable::Find(mxi::Atom const name) const noexcept
+    {
+        auto const found = std::find(m_names.begin(), m_names.end(), name);
+        return (found == m_names.end()) ? npos : static_cast<size_t>(found - m_names.begin());
+    }
+
+    std::string_view AttributeTable::Get(mxi::Atom const name) const noexcept
+    {
+        auto const n = Find(name);
+        return (n == npos) ? std::string_view{} : m_values[n];
+    }
+
+    void AttributeTable::Set(mxi::Atom const name, std::string_view const & value)
+    {
+        // Copy first, as value may view the copy being replaced
+        auto copy = std::make_unique<std::string>(value);
+        auto const n = Slot(name);
+        if (m_owned.size() <= n) m_owned.resize(m_names.size());
+        Assign(n, *copy);
+        m_owned[n] = std::move(copy);
+    }
+
+    void AttributeTable::Borrow(mxi::Atom const name, std::string_view const & value)
     {
-        for (auto const complex : rule.selectors)
+        auto const n = Slot(name);
+        if (n < m_owned.size()) m_owned[n].reset();
+        Assign(n, value);
+    }
+
+    size_t AttributeTable::Slot(mxi::Atom const name)
+    {
+        auto const n = Find(name);
+        if (n != npos) return n;
+        m_names.push_back(name);
+        m_values.emplace_back();
+        m_hashes.push_back(0);
+        return m_names.size() - 1;
+    }
+
+    void AttributeTable::Assign(size_t const n, std::string_view const & value)
+    {
+        m_values[n] = value;
+        m_hashes[n] = mxi::hash_bytes(value);
+    }
+
+    bool CaelusElement::MatchesSelector(ComplexSelector const & complex) const
+    {
+        // Each ANCESTOR or ANY_PREV_SIBLING step leaves a choice point; on failure we resume the latest one
+        // from the element it last chose. Only one choice per step is live at a time, so this never overflows.
+        class Choice
         {
-            if (MatchesSimpleSelector(complex.second.back())) return complex.first;
+        public:
+            size_t pc;
+            CaelusElement const * element;
+        };
+        auto choices = std::array<Choice, ComplexSelector::kMaxCompounds>{};
+        size_t depth = 0;
+
+        auto element = this;
+        size_t pc = 0;
+        for (;;)
+        {
+            auto const & instruction = complex.program[pc];
+            switch (instruction.op)
+            {
+            case SelectorOp::DONE:
+                return true;
+            case SelectorOp::MATCH:
+                if (!element->MatchesCompound(complex.compounds[instruction.compound])) element = nullptr;
+                break;
+            case SelectorOp::PARENT:
+                element = element->m_parent;
+                break;
+            case SelectorOp::ANCESTOR:
+                element = element->m_parent;
+                // Any other choice further back only leads to elements with fewer ancestors, so searching
+                // past the root means the whole selector fails
+                if (!element) return false;
+                choices[depth++] = { pc, element };
+                break;
+            case SelectorOp::PREV_SIBLING:
+                element = element->GetPreviousSibling();
+                break;
+            case SelectorOp::ANY_PREV_SIBLING:
+                element = element->GetPreviousSibling();
+                if (element) choices[depth++] = { pc, element };
+                break;
+            }
+            if (element)
+            {
+                ++pc;
+                continue;
+            }
+
+            // Backtrack: redo the latest choice's step from the element it chose, moving one further on
+            if (!depth) return false;
+            --depth;
+            pc = choices[depth].pc;
+            element = choices[depth].element;
         }
-        return 0;
+    }
+
+    std::optional<uint64_t> CaelusElement::GetCssRuleSpecificity(RuleIndex::Entry const & entry) const
+    {
+        auto const & complex = entry.rule->selectors[entry.selector];
+        if (MatchesSelector(complex)) return complex.specificity;
+        return std::nullopt;
     }
 
 }
\ No newline at end of file
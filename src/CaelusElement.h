@@ -1,10 +1,15 @@
 #pragma once
 
+#include <memory>
+#include <new>
+#include <unordered_map>
+
 #include <Windows.h>
 
 #include "jass.h"
 
 #include "CaelusClass.h"
+#include "CaelusStyle.h"
 #include "MxiLogging.h"
 #include "MxiUtils.h"
 
@@ -16,12 +21,78 @@ namespace Caelus
     LRESULT CaelusElement_WndProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
     class CaelusWindow;
+    class ElementArena;
+
+    // An element's attributes as parallel arrays of interned names, values and value hashes. Elements carry a
+    // handful of attributes, so scanning the names beats hashing, and selectors compare hashes before strings.
+    // Values parsed from a document are borrowed from the window's retained source; only Set makes a copy.
+    class AttributeTable
+    {
+    public:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        // Index of the attribute, or npos.
+        size_t Find(mxi::Atom const name) const noexcept;
+        bool Has(mxi::Atom const name) const noexcept { return Find(name) != npos; }
+
+        // The attribute's value, or "" if it is not set.
+        std::string_view Get(mxi::Atom const name) const noexcept;
+        void Set(mxi::Atom const name, std::string_view const & value);
+
+        // As Set, but value must outlive the table.
+        void Borrow(mxi::Atom const name, std::string_view const & value);
+
+        size_t size() const noexcept { return m_names.size(); }
+        std::vector<mxi::Atom> const & GetNames() const noexcept { return m_names; }
+        std::string_view GetValue(size_t const n) const { return m_values[n]; }
+        uint64_t GetHash(size_t const n) const { return m_hashes[n]; }
+
+    private:
+        size_t Slot(mxi::Atom const name);
+        void Assign(size_t const n, std::string_view const & value);
+
+        std::vector<mxi::Atom> m_names = {};
+        std::vector<std::string_view> m_values = {};
+        std::vector<uint64_t> m_hashes = {}; // mxi::hash_bytes of each value
+        std::vector<std::unique_ptr<std::string>> m_owned = {}; // copies made by Set; empty until the first one
+    };
 
     class CaelusElement
     {
         friend class CaelusWindow;
-        friend class JamlParser;
+        friend class ElementArena;
+        friend class JamlDomBuilder;
+        friend class Snapshot;
     public:
+        // Iterates an element's children by following the sibling links.
+        template<typename E>
+        class ChildRange
+        {
+        public:
+            class iterator
+            {
+            public:
+                using difference_type = std::ptrdiff_t;
+                using value_type = E;
+                iterator() = default;
+                explicit iterator(E * const element) noexcept : m_element(element) {}
+                E & operator*() const noexcept { return *m_element; }
+                E * operator->() const noexcept { return m_element; }
+                iterator & operator++() noexcept { m_element = m_element->m_nextSibling; return *this; }
+                iterator operator++(int) noexcept { auto const old = *this; ++*this; return old; }
+                bool operator==(iterator const &) const = default;
+            private:
+                E * m_element = nullptr;
+            };
+
+            explicit ChildRange(E * const first) noexcept : m_first(first) {}
+            iterator begin() const noexcept { return iterator{ m_first }; }
+            iterator end() const noexcept { return {}; }
+
+        private:
+            E * m_first;
+        };
+
         // Painting
         static void Register(HINSTANCE hInstance, wchar_t const * standardClass = nullptr, wchar_t const * caelusClass = nullptr, CaelusElementType const type = GENERIC);
         LRESULT Paint(HWND hwnd, HDC hdc);
@@ -30,7 +101,9 @@ namespace Caelus
 
         // Element arrangement
         CaelusElement(std::string_view const & name);
-        CaelusElement * FindElement(std::string_view const & name);
+        CaelusElement(CaelusElement const &) = delete;
+        CaelusElement & operator=(CaelusElement const &) = delete;
+        CaelusElement * FindElement(std::string_view const & name); // this or a descendant; uses the window's index
         CaelusElement * AppendChild(std::string_view const & name);
         CaelusElement * InsertChild(std::string_view const & name, size_t n);
         void Remove();
@@ -39,125 +112,38 @@ namespace Caelus
         void show();
         void hide();
         CaelusElement * GetChild(size_t const n) const noexcept;
+        size_t GetChildCount() const noexcept { return m_childCount; }
+        ChildRange<CaelusElement> Children() noexcept { return ChildRange<CaelusElement>{ m_firstChild }; }
+        ChildRange<CaelusElement const> Children() const noexcept { return ChildRange<CaelusElement const>{ m_firstChild }; }
         HWND GetHwnd() const noexcept;
         CaelusElement * GetParent() noexcept;
         CaelusWindow const * GetWindow() const;
+        CaelusWindow * GetWindow();
 
         std::string const & GetValue() const;
 
         // Style getters
-        template<typename T>
-        std::optional<T> const & GetStyle(CaelusElementStyle style, int const edge = 0) const
-        {
-            auto elem = this;
-            while (elem)
-            {
-                auto const & v = elem->m_class->GetStyle<T>(style, edge);
-                if (v.has_value()) return v;
-
-                switch (style)
-                {
-                case BORDER_WIDTH:
-                case LABEL:
-                case PADDING:
-                case SIZE:
-                case TETHER:
-                    // Uninheritable
-                    break;
-                default:
-                    elem = elem->m_parent;
-                    continue;
-                }
-                break;
-            }
-
-            // Default styles
-            if constexpr (std::is_same_v<T, Color>)
-            {
-                switch (style)
-                {
-                case BACKGROUND_COLOR: { static std::optional<Color> v = 0xFFFFFF; return v; }
-                case BORDER_COLOR: { static std::optional<Color> v = 0; return v; }
-                case TEXT_COLOR: { static std::optional<Color> v = 0; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, Measure>)
-            {
-                switch (style)
-                {
-                case BORDER_RADIUS: { static std::optional<Measure> v = { Measure::Parse("0") }; return v; }
-                case BORDER_WIDTH: { static std::optional<Measure> v = { Measure::Parse("0") }; return v; }
-                case FONT_SIZE: { static std::optional<Measure> v = { Measure::Parse("12pt") }; return v; }
-                case PADDING: { static std::optional<Measure> v = { Measure::Parse("0") }; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, std::string>)
-            {
-                switch (style)
-                {
-                case FONT_FACE: { static std::optional<std::string> v = "Arial"; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, bool>)
-            {
-                switch (style)
-                {
-                case FONT_ITALIC: { static std::optional<bool> v = false; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, int>)
-            {
-                switch (style)
-                {
-                case FONT_WEIGHT: { static std::optional<int> v = FontWeight::REGULAR; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, Tether>)
-            {
-            }
-            else if constexpr (std::is_same_v<T, Edge>)
-            {
-                switch (style)
-                {
-                case TEXT_ALIGNH: { static std::optional<Edge> v = Edge::LEFT; return v; }
-                case TEXT_ALIGNV: { static std::optional<Edge> v = Edge::TOP; return v; }
-                }
-            }
-            else if constexpr (std::is_same_v<T, CaelusElementType>)
-            {
-                switch (style)
-                {
-                case ELEMENT_TYPE: { static std::optional<CaelusElementType> v = CaelusElementType::GENERIC; return v; }
-                }
-            }
-            else
-            {
-                static_assert(mxi::always_false<T>, "Unsupported type for GetStyle()");
-            }
-
-            static std::optional<T> def{};
-            return def;
-        }
+        ComputedStyle const & GetComputedStyle() const;
 
-        CaelusElement const * find(size_t uid) const;
+        // A descendant by "#id" (indexed) or by tag name.
         CaelusElement const * find(std::string_view const & search) const;
 
-        Color const & GetBackgroundColor() const { return GetStyle<Color>(BACKGROUND_COLOR).value(); }
-        Color const & GetBorderColor(Edge const edge) const { return GetStyle<Color>(BORDER_COLOR, edge).value(); }
-        Color const & GetTextColor() const { return GetStyle<Color>(TEXT_COLOR).value(); }
-        Measure const & GetBorderRadius(Corner const corner) const { return GetStyle<Measure>(BORDER_RADIUS, corner).value(); }
-        Measure const & GetBorderWidth(Edge const edge) const { return GetStyle<Measure>(BORDER_WIDTH, edge).value(); }
-        Measure const & GetFontSize() const { return GetStyle<Measure>(FONT_SIZE).value(); }
-        CaelusElementType GetElementType() const { auto const & type = GetStyle<CaelusElementType>(ELEMENT_TYPE); return type.has_value() ? type.value() : GENERIC; }
-        Measure const & GetPadding(Edge const edge) const { return GetStyle<Measure>(PADDING, edge).value(); }
-        std::optional<Measure> const & GetSize(Dimension const dim) const { return GetStyle<Measure>(SIZE, dim); }
-        std::optional<Tether> const & GetTether(Edge const edge) const { return GetStyle<Tether>(TETHER, edge); }
-        Edge GetTextAlignH() const { return GetStyle<Edge>(TEXT_ALIGNH).value(); }
-        Edge GetTextAlignV() const { return GetStyle<Edge>(TEXT_ALIGNV).value(); }
-        std::string const & GetFontFace() const { return GetStyle<std::string>(FONT_FACE).value(); }
-        std::optional<std::string> const & GetLabel() const { return GetStyle<std::string>(LABEL); }
-        bool GetFontItalic() const { return GetStyle<bool>(FONT_ITALIC).value(); }
-        int GetFontWeight() const { return GetStyle<int>(FONT_WEIGHT).value(); }
+        Color const & GetBackgroundColor() const { return GetComputedStyle().backgroundColor; }
+        Color const & GetBorderColor(Edge const edge) const { return GetComputedStyle().borderColor[edge]; }
+        Color const & GetTextColor() const { return GetComputedStyle().textColor; }
+        Measure const & GetBorderRadius(Corner const corner) const { return GetComputedStyle().borderRadius[corner]; }
+        Measure const & GetBorderWidth(Edge const edge) const { return GetComputedStyle().borderWidth[edge]; }
+        Measure const & GetFontSize() const { return GetComputedStyle().fontSize; }
+        CaelusElementType GetElementType() const { return GetComputedStyle().elementType; }
+        Measure const & GetPadding(Edge const edge) const { return GetComputedStyle().padding[edge]; }
+        std::optional<Measure> const & GetSize(Dimension const dim) const { return GetComputedStyle().size[dim]; }
+        std::optional<Tether> const & GetTether(Edge const edge) const { return GetComputedStyle().tethers[edge]; }
+        Edge GetTextAlignH() const { return GetComputedStyle().alignTextH.value(); }
+        Edge GetTextAlignV() const { return GetComputedStyle().alignTextV.value(); }
+        std::string const & GetFontFace() const { return GetComputedStyle().fontFace; }
+        std::optional<std::string> const & GetLabel() const { return GetComputedStyle().label; }
+        bool GetFontItalic() const { return GetComputedStyle().fontItalic; }
+        int GetFontWeight() const { return GetComputedStyle().fontWeight; }
 
         static Tether const GetDefaultTether(Edge const edge) { return { ".", ~edge, { 0, PX } }; }
 
@@ -184,16 +170,33 @@ namespace Caelus
         void SetValue(std::string_view const & value);
         void SetVisible(bool const visible = true);
 
+        // Classes and attributes (these invalidate computed styles)
+        void AddClass(std::string_view const & name);
+        void RemoveClass(std::string_view const & name);
+        void SetAttribute(std::string_view const & name, std::string_view const & value);
+
         void tether(Edge const myEdge, std::string_view const & otherId, Edge const otherEdge, Measure const & offset);
         void tether(Edge const myEdge, std::string const & spec);
 
     protected:
         CaelusElement() = default;
         void Build();
+        void ParseStyleAttribute(); // into m_styles, replacing them. Throws if a declaration is malformed.
         void Spawn(HINSTANCE hInstance, HWND outerWindow = NULL);
         void PrepareToComputeLayout();
         wchar_t const * GetWindowClass() const;
         void UpdateFont();
+        void InvalidateStyle();
+
+        // Mark the elements a class, id or attribute change affects (a mask of jass::Invalidation) for restyle.
+        void ScheduleRestyle(uint8_t const invalidation);
+        void MarkForRestyle(CaelusWindow const & window) const;
+        void MarkDescendantsForRestyle(CaelusWindow const & window) const;
+        void CancelRestyles(CaelusWindow const & window) const noexcept; // of this subtree, before it is destroyed
+
+        // Top-down restyle of this subtree, using filter to reject rules by their ancestor atoms.
+        // Unless full, only subtrees marked for restyle are visited.
+        void ResolveStyles(AncestorFilter & filter, uint64_t const generation, bool const full);
 
         // Resolves as many coordinates as possible (single pass) and returns the number of unresolved coordinates/dimensions.
         size_t ComputeLayout();
@@ -208,13 +211,30 @@ namespace Caelus
         // Move futureRect to currentRect and redraw everything
         HDWP CommitLayout(HINSTANCE hInstance, HDWP hdwp, HWND outerWindow = NULL);
 
-        CaelusElement * GetSibling(std::string_view const & name) const;
+        CaelusElement * GetSibling(std::string_view const & name) const; // by name, through the parent's index
         CaelusElement * GetSibling(Edge const edge) const;
+        CaelusElement const * GetPreviousSibling() const noexcept; // skipping text nodes
+        bool IsText() const noexcept { return !m_tagname && m_name.empty(); } // parsed elements have a tag, created ones a name
+        void ChildrenChanged();
+
+        // Splice child in before next (or at the end), or out again; neither allocates nor frees.
+        void LinkChild(CaelusElement * const child, CaelusElement * const next = nullptr) noexcept;
+        void UnlinkChild(CaelusElement * const child) noexcept;
+        void ReindexChildren(CaelusElement * const first) noexcept;
+
+        // Destroy every descendant without the restyle bookkeeping of RemoveChildren.
+        void DestroyChildren(ElementArena & arena) noexcept;
 
-        std::vector<CaelusElement> m_children = {};
         CaelusClass * m_class = nullptr;
         std::string m_name;
         CaelusElement * m_parent = nullptr;
+        CaelusElement * m_firstChild = nullptr;
+        CaelusElement * m_lastChild = nullptr;
+        CaelusElement * m_prevSibling = nullptr;
+        CaelusElement * m_nextSibling = nullptr;
+        size_t m_childCount = 0; // not counting text nodes
+        size_t m_index = 0; // position among m_parent's non-text children; a text node has its next element's
+        std::unique_ptr<std::unordered_multimap<std::string_view, CaelusElement *>> m_childNames = {}; // named children; made for the first
         ResolvedRect m_currentRect;
         ResolvedRect m_futureRect;
         HFONT m_hfont = NULL;
@@ -222,16 +242,22 @@ namespace Caelus
 
 
     private:
-        std::string const & GetCssProp(char const * property) const;
-        uint64_t GetCssRuleSpecificity(Rule const & rule) const;
-        bool MatchesSimpleSelector(Selector const & simple) const;
-        bool MatchesComplexSelector(Selector complex) const;
-        std::unordered_map<std::string, std::string> m_attributes = {};
-        std::vector<std::string> m_classes = {};
-        std::string m_id = {};
-        std::unordered_map<char const *, std::string> m_styles = {};
-        std::string m_tagname = {};
-        std::string m_text = {};
+        void ComputeStyle(uint64_t const generation, AncestorFilter * filter = nullptr) const;
+        std::optional<uint64_t> GetCssRuleSpecificity(RuleIndex::Entry const & entry) const;
+        uint64_t GetAttributeHash() const;
+        bool MatchesCompound(Selector const & compound) const;
+        bool MatchesSelector(ComplexSelector const & complex) const;
+        void SetClasses(std::string_view const & classes);
+        bool Contains(CaelusElement const & element) const noexcept; // element is this or a descendant
+        AttributeTable m_attributes = {};
+        std::vector<mxi::Atom> m_classes = {}; // sorted
+        mxi::Atom m_id = mxi::kNullAtom;
+        jass::Declarations m_styles = {};
+        mutable ComputedStyle m_style = {};
+        mutable bool m_needsRestyle = false;
+        mutable bool m_childNeedsRestyle = false;
+        mxi::Atom m_tagname = mxi::kNullAtom;
+        std::string_view m_text = {}; // into the window's retained source or unescaped text
 
         void PaintBackground(HDC hdc, RECT const & rectClient) const;
         void PaintBorder(HDC hdc, RECT const & rectClient, Edge const edge) const;
@@ -239,4 +265,45 @@ namespace Caelus
         static WNDPROC StandardWndProc[CaelusElementType::last];
         static wchar_t const * CaelusClassName[CaelusElementType::last];
     };
+
+    // Bump allocator for the elements of one window. Elements are carved out of blocks of kBlockSize and never move,
+    // so the links between them stay valid; slots of removed elements are reused before a new block is taken.
+    class ElementArena
+    {
+    public:
+        static constexpr size_t kBlockSize = 256;
+
+        ElementArena() = default;
+        ElementArena(ElementArena const &) = delete;
+        ElementArena & operator=(ElementArena const &) = delete;
+
+        template<typename... Args>
+        CaelusElement * Create(Args &&... args)
+        {
+            auto const slot = Allocate();
+            try
+            {
+                return new (slot) CaelusElement(std::forward<Args>(args)...);
+            }
+            catch (...)
+            {
+                m_free.push_back(slot);
+                throw;
+            }
+        }
+
+        // Runs the element's destructor and recycles its slot. Does not touch its children or links.
+        void Destroy(CaelusElement * const element) noexcept;
+
+        size_t GetBlockCount() const noexcept { return m_blocks.size(); }
+
+    private:
+        static_assert(alignof(CaelusElement) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+        void * Allocate();
+
+        std::vector<std::unique_ptr<std::byte[]>> m_blocks = {};
+        size_t m_used = 0; // slots handed out from the last block
+        std::vector<void *> m_free = {};
+    };
 }
\ No newline at end of file
@@ -122,27 +122,71 @@ namespace Caelus
         MX_THROW("Invalid edge specified.");
     }
 
-    Measure Measure::Parse(std::string_view const & specv)
+    Measure Measure::Parse(std::string_view const & spec)
     {
-        auto const spec = std::string{ specv };
-        constexpr static auto const pattern = R"(^([0-9]+(?:\.?[0-9]+)?)(em|px|pt|%)?$)";
+        auto const measure = TryParse(spec);
+        if (!measure)
+        {
+            // TODO "entangled" => max of all elements with same class
+            MX_THROW(std::format("Invalid size: bad format. Expected N[.F][px|em|pt|%], saw {}", spec).c_str());
+        }
+        return measure.value();
+    }
+
+    Tether Tether::Parse(Edge const myEdge, std::string_view const & tether)
+    {
+        /* Examples
+            left=id.right+5px //explicit sibling
+            left=5px //parent
+            left=+5px // sibling
+        */
+        auto spec = std::string{ mxi::trim(tether) };
+        constexpr static auto const pattern = R"(^(?:([^\.]+)\.(left|right|bottom|top|l|r|t|b))?(?:\s+)?(?:(\+|\-)?(?:\s+)?([0-9]+(?:\.[0-9]+)?)(em|px|%|))?$)";
         static auto const regex = std::regex(pattern, std::regex_constants::ECMAScript);
 
+        static auto const msgFormat = "Invalid tether: bad format. Expected [id.side][[+|-]offset[px|em|%]], saw {}";
+        static auto const msgEdge = "Invalid tether : incompatible edge axis.";
+
         auto matches = std::smatch{};
         if (!std::regex_search(spec, matches, regex))
         {
-            // TODO "entangled" => max of all elements with same class
-            MX_THROW(std::format("Invalid size: bad format. Expected N[.F][px|em|pt|%], saw {}", spec).c_str());
+            MX_THROW(std::format(msgFormat, spec).c_str());
         }
 
-        double offset = atof(matches[1].str().c_str());
-        std::string const unitStr = (matches.length() >= 2) ? matches[2].str() : "";
-        auto unit = Unit::PX;
-        if (unitStr == "em") unit = EM;
-        else if (unitStr == "%") unit = PC;
-        else if (unitStr == "pt") unit = PT;
+        auto name = matches[1].str();
+        auto const sedge = matches[2].str();
+        auto const sop = matches[3].str();
+        auto const soffset = matches[4].str();
+        auto const sunit = matches[5].str();
+
+        double offset = soffset.empty() ? 0 : atof(soffset.c_str());
+        Edge otherEdge = myEdge;
+
+        if (!name.empty())
+        {
+            // Normal tether
+            otherEdge = keywordToEdge(sedge);
+            if (isHEdge(otherEdge) != isHEdge(otherEdge)) MX_THROW(msgEdge);
+            if (sop.empty() && !soffset.empty())  MX_THROW(std::format(msgFormat, spec).c_str());
+            if (sop == "-") offset = -offset;
+        }
+        else if (sop.empty())
+        {
+            // Absolute within parent
+            if (myEdge == BOTTOM || myEdge == RIGHT) offset = -offset;
+        }
+        else
+        {
+            // Tether to adjacent sibling
+            name = ".";
+            if (myEdge == TOP || myEdge == LEFT) offset = -offset;
+            otherEdge = ~myEdge;
+        }
 
-        return { offset, unit };
+        auto unit = Unit::PX;
+        if (sunit == "em") unit = EM;
+        else if (sunit == "%") { unit = PC; offset /= 100; }
+        return { name, otherEdge, { offset, unit } };
     }
 
     int ResolvedRect::GetBorder(Edge const edge) const
@@ -6,6 +6,8 @@
 
 #include <Windows.h>
 
+#include "MxiUtils.h"
+
 namespace Caelus
 {
     enum Axis
@@ -36,18 +38,49 @@ namespace Caelus
     {
     public:
         static Measure Parse(std::string_view const & spec);
+
+        // As Parse, but returns std::nullopt instead of throwing. Usable at compile time.
+        static constexpr std::optional<Measure> TryParse(std::string_view const & spec);
+
         double value;
         Unit unit;
 
-        Measure(double const value, Unit const unit) : unit(unit), value(value) {};
-        Measure(double const value) : value(value), unit(PX) {};
-        Measure() : value(0), unit(PX) {};
-        Measure(Measure const &) = default;
+        constexpr Measure(double const value, Unit const unit) : unit(unit), value(value) {};
+        constexpr Measure(double const value) : value(value), unit(PX) {};
+        constexpr Measure() : value(0), unit(PX) {};
+        constexpr Measure(Measure const &) = default;
+        constexpr bool operator==(Measure const &) const = default;
     };
 
+    constexpr std::optional<Measure> Measure::TryParse(std::string_view const & spec)
+    {
+        auto pos = size_t{ 0 };
+        auto const value = mxi::scan_decimal(spec, pos);
+        if (!value) return std::nullopt;
+
+        auto const unit = spec.substr(pos);
+        if (unit.empty() || unit == "px") return Measure{ value.value(), PX };
+        if (unit == "em") return Measure{ value.value(), EM };
+        if (unit == "pt") return Measure{ value.value(), PT };
+        if (unit == "%") return Measure{ value.value(), PC };
+        return std::nullopt;
+    }
+
+    inline namespace literals
+    {
+        // "12pt"_measure, "1.5em"_measure etc; malformed literals fail to compile.
+        consteval Measure operator""_measure(char const * s, size_t const n)
+        {
+            auto const measure = Measure::TryParse({ s, n });
+            if (!measure) throw "Invalid measure literal";
+            return measure.value();
+        }
+    }
+
     class Tether
     {
     public:
+        static Tether Parse(Edge const myEdge, std::string_view const & spec);
         Tether(std::string_view const & id, Edge const edge, Measure const & offset) : id(id), edge(edge), offset(offset) {};
         std::string id;
         Edge edge;
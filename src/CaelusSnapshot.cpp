@@ -0,0 +1,598 @@
+#include <format>
+#include <fstream>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+#include "MxiAtom.h"
+#include "MxiLogging.h"
+#include "MxiUtils.h"
+
+#include "jassc.h"
+
+#include "CaelusWindow.h"
+#include "default.jass.h"
+
+#include "CaelusSnapshot.h"
+
+namespace Caelus
+{
+    using namespace jass;
+
+    namespace
+    {
+        constexpr uint32_t kMagic = 0x504E5343; // "CSNP"
+        constexpr uint32_t kNone = 0xFFFFFFFF;
+
+        // On-disk records. Sections follow the header in this order: styles, sheets, elements, attributes, lists,
+        // strings, the string bytes, then (8-byte aligned) blobs of compiled rules. The header, styles and sheets
+        // are 8-byte records, everything after them is 4-byte, so every section is naturally aligned in a mapped
+        // view.
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t documentHash;
+            uint32_t styleCount;
+            uint32_t sheetCount;
+            uint32_t elementCount;
+            uint32_t attributeCount;
+            uint32_t listCount;
+            uint32_t stringCount;
+            uint32_t charCount;
+            uint32_t blobSize;
+            uint32_t inlineRulesOffset; // into the blobs; elements' inline declarations, compiled as selectorless rules
+            uint32_t inlineRulesSize;
+        };
+
+        struct MeasureRecord
+        {
+            double value;
+            uint32_t unit;
+            uint32_t present; // for optional measures
+        };
+
+        struct TetherRecord
+        {
+            MeasureRecord offset;
+            uint32_t id; // string index, or kNone if there is no tether
+            uint32_t edge;
+        };
+
+        // A ComputedStyle. Elements that share a style share a record.
+        struct StyleRecord
+        {
+            MeasureRecord borderRadius[4];
+            MeasureRecord borderWidth[4];
+            MeasureRecord padding[4];
+            MeasureRecord size[2];
+            MeasureRecord fontSize;
+            TetherRecord tethers[4];
+            uint32_t backgroundColor; // argb
+            uint32_t borderColor[4];
+            uint32_t textColor;
+            uint32_t elementType;
+            uint32_t fontFace; // string index
+            uint32_t fontItalic;
+            uint32_t fontWeight;
+            uint32_t label; // string index or kNone
+            uint32_t alignTextH; // edge or kNone
+            uint32_t alignTextV;
+            uint32_t reserved;
+        };
+
+        enum SheetKind : uint32_t
+        {
+            EMBEDDED, // compiled into the executable; only referenced
+            LINKED, // a shared sheet loaded from a file; only referenced
+            INLINE, // a style block; its compiled rules are in the blobs
+        };
+
+        struct SheetRecord
+        {
+            uint64_t sourceHash;
+            uint32_t kind;
+            uint32_t name; // string index: embedded name, file path or sheet name
+            uint32_t blobOffset;
+            uint32_t blobSize;
+        };
+
+        // In document order, so a parent always comes before its children and children in sibling order.
+        struct ElementRecord
+        {
+            uint32_t parent; // element index, or kNone for the window
+            uint32_t tag; // string index or kNone
+            uint32_t name;
+            uint32_t id;
+            uint32_t text;
+            uint32_t firstClass; // into lists
+            uint32_t classCount;
+            uint32_t firstAttribute;
+            uint32_t attributeCount;
+            uint32_t inlineRule; // index into the inline rules, or kNone
+            uint32_t style;
+        };
+
+        struct AttributeRecord
+        {
+            uint32_t name; // string index
+            uint32_t value;
+        };
+
+        struct StringRecord
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        static_assert(sizeof(FileHeader) % 8 == 0 && sizeof(StyleRecord) % 8 == 0 && sizeof(SheetRecord) % 8 == 0);
+
+        constexpr size_t AlignTo8(size_t const n) { return (n + 7) & ~size_t{ 7 }; }
+
+        MeasureRecord EncodeMeasure(Measure const & m)
+        {
+            return { m.value, static_cast<uint32_t>(m.unit), 1 };
+        }
+
+        MeasureRecord EncodeMeasure(std::optional<Measure> const & m)
+        {
+            return m ? EncodeMeasure(*m) : MeasureRecord{};
+        }
+
+        uint32_t EncodeEdge(std::optional<Edge> const & edge)
+        {
+            return edge ? static_cast<uint32_t>(static_cast<Edge::Value>(*edge)) : kNone;
+        }
+
+        Edge const & DecodeEdge(uint32_t const edge)
+        {
+            if (edge <= static_cast<uint32_t>(Edge::Value::RIGHT))
+            {
+                switch (static_cast<Edge::Value>(edge))
+                {
+                case Edge::Value::TOP: return Edge::TOP;
+                case Edge::Value::LEFT: return Edge::LEFT;
+                case Edge::Value::BOTTOM: return Edge::BOTTOM;
+                case Edge::Value::RIGHT: return Edge::RIGHT;
+                }
+            }
+            MX_THROW(std::format("Invalid edge {} in snapshot", edge));
+        }
+
+        Measure DecodeMeasure(MeasureRecord const & m)
+        {
+            if (m.unit > Unit::PC) MX_THROW(std::format("Invalid unit {} in snapshot", m.unit));
+            return { m.value, static_cast<Unit>(m.unit) };
+        }
+
+        class Writer
+        {
+        public:
+            uint32_t String(std::string_view const & s)
+            {
+                auto const found = m_stringIndex.find(std::string{ s });
+                if (found != m_stringIndex.end()) return found->second;
+                auto const n = static_cast<uint32_t>(m_strings.size());
+                m_strings.push_back({ static_cast<uint32_t>(m_chars.size()), static_cast<uint32_t>(s.size()) });
+                m_chars.append(s);
+                m_stringIndex.emplace(s, n);
+                return n;
+            }
+
+            uint32_t Optional(std::string_view const & s)
+            {
+                return s.empty() ? kNone : String(s);
+            }
+
+            uint32_t Atom(mxi::Atom const atom)
+            {
+                return atom ? String(mxi::atom_name(atom)) : kNone;
+            }
+
+            // Offset of bytes, copied into the blobs at an 8-byte boundary.
+            uint32_t Blob(std::string_view const & bytes)
+            {
+                m_blobs.resize(AlignTo8(m_blobs.size()));
+                auto const offset = static_cast<uint32_t>(m_blobs.size());
+                m_blobs.append(bytes);
+                return offset;
+            }
+
+            uint32_t Style(ComputedStyle const & style)
+            {
+                auto record = StyleRecord{};
+                for (size_t n = 0; n < 4; ++n)
+                {
+                    record.borderRadius[n] = EncodeMeasure(style.borderRadius[n]);
+                    record.borderWidth[n] = EncodeMeasure(style.borderWidth[n]);
+                    record.padding[n] = EncodeMeasure(style.padding[n]);
+                    record.borderColor[n] = style.borderColor[n].argb();
+                    record.tethers[n].id = kNone;
+                    if (auto const & tether = style.tethers[n])
+                    {
+                        record.tethers[n] = { EncodeMeasure(tether->offset), String(tether->id), EncodeEdge(tether->edge) };
+                    }
+                }
+                for (size_t n = 0; n < 2; ++n) record.size[n] = EncodeMeasure(style.size[n]);
+                record.fontSize = EncodeMeasure(style.fontSize);
+                record.backgroundColor = style.backgroundColor.argb();
+                record.textColor = style.textColor.argb();
+                record.elementType = static_cast<uint32_t>(style.elementType);
+                record.fontFace = String(style.fontFace);
+                record.fontItalic = style.fontItalic ? 1u : 0u;
+                record.fontWeight = static_cast<uint32_t>(style.fontWeight);
+                record.label = style.label ? String(*style.label) : kNone;
+                record.alignTextH = EncodeEdge(style.alignTextH);
+                record.alignTextV = EncodeEdge(style.alignTextV);
+
+                // Records have no padding, so equal styles have equal bytes
+                auto key = std::string{ reinterpret_cast<char const *>(&record), sizeof(record) };
+                auto const found = m_styleIndex.find(key);
+                if (found != m_styleIndex.end()) return found->second;
+                auto const n = static_cast<uint32_t>(m_styles.size());
+                m_styles.push_back(record);
+                m_styleIndex.emplace(std::move(key), n);
+                return n;
+            }
+
+            std::vector<StyleRecord> m_styles = {};
+            std::vector<SheetRecord> m_sheets = {};
+            std::vector<ElementRecord> m_elements = {};
+            std::vector<AttributeRecord> m_attributes = {};
+            std::vector<uint32_t> m_lists = {};
+            std::vector<StringRecord> m_strings = {};
+            std::string m_chars = {};
+            std::string m_blobs = {};
+
+        private:
+            std::unordered_map<std::string, uint32_t> m_stringIndex = {};
+            std::unordered_map<std::string, uint32_t> m_styleIndex = {};
+        };
+
+        // The sections of a mapped snapshot. Accessors throw on an out-of-range index.
+        class Sections
+        {
+        public:
+            bool Read(std::string_view const & data)
+            {
+                m_data = data;
+                header = Section<FileHeader>(1);
+                if (!header || header->magic != kMagic || header->version != Snapshot::kVersion) return false;
+                styles = Section<StyleRecord>(header->styleCount);
+                sheets = Section<SheetRecord>(header->sheetCount);
+                elements = Section<ElementRecord>(header->elementCount);
+                attributes = Section<AttributeRecord>(header->attributeCount);
+                lists = Section<uint32_t>(header->listCount);
+                strings = Section<StringRecord>(header->stringCount);
+                chars = Section<char>(header->charCount);
+                m_pos = AlignTo8(m_pos);
+                blobs = Section<char>(header->blobSize);
+                return m_ok && header->elementCount;
+            }
+
+            std::string_view String(uint32_t const n) const
+            {
+                if (n >= header->stringCount) MX_THROW(std::format("Invalid string {} in snapshot", n));
+                auto const & s = strings[n];
+                if (s.offset > header->charCount || s.length > header->charCount - s.offset) MX_THROW("Invalid string in snapshot");
+                return { chars + s.offset, s.length };
+            }
+
+            std::string_view Optional(uint32_t const n) const
+            {
+                return (n == kNone) ? std::string_view{} : String(n);
+            }
+
+            mxi::Atom Atom(uint32_t const n) const
+            {
+                return (n == kNone) ? mxi::kNullAtom : mxi::intern(String(n));
+            }
+
+            template<typename T>
+            std::span<T const> Range(T const * const section, uint32_t const count, uint32_t const first, uint32_t const n) const
+            {
+                if (first > count || n > count - first) MX_THROW("Invalid range in snapshot");
+                return { section + first, n };
+            }
+
+            std::string_view Blob(uint32_t const offset, uint32_t const size) const
+            {
+                auto const range = Range(blobs, header->blobSize, offset, size);
+                return { range.data(), range.size() };
+            }
+
+            FileHeader const * header = nullptr;
+            StyleRecord const * styles = nullptr;
+            SheetRecord const * sheets = nullptr;
+            ElementRecord const * elements = nullptr;
+            AttributeRecord const * attributes = nullptr;
+            uint32_t const * lists = nullptr;
+            StringRecord const * strings = nullptr;
+            char const * chars = nullptr;
+            char const * blobs = nullptr;
+
+        private:
+            template<typename T>
+            T const * Section(size_t const count)
+            {
+                if (!m_ok || count > (m_data.size() - m_pos) / sizeof(T)) { m_ok = false; return nullptr; }
+                auto const p = reinterpret_cast<T const *>(m_data.data() + m_pos);
+                m_pos += count * sizeof(T);
+                return p;
+            }
+
+            std::string_view m_data = {};
+            size_t m_pos = 0;
+            bool m_ok = true;
+        };
+
+        void DecodeStyle(Sections const & s, StyleRecord const & record, ComputedStyle & style)
+        {
+            for (size_t n = 0; n < 4; ++n)
+            {
+                style.borderRadius[n] = DecodeMeasure(record.borderRadius[n]);
+                style.borderWidth[n] = DecodeMeasure(record.borderWidth[n]);
+                style.padding[n] = DecodeMeasure(record.padding[n]);
+                style.borderColor[n].argb(record.borderColor[n]);
+                auto const & tether = record.tethers[n];
+                if (tether.id == kNone) style.tethers[n].reset();
+                else style.tethers[n] = Tether{ s.String(tether.id), DecodeEdge(tether.edge), DecodeMeasure(tether.offset) };
+            }
+            for (size_t n = 0; n < 2; ++n)
+            {
+                if (record.size[n].present) style.size[n] = DecodeMeasure(record.size[n]);
+                else style.size[n].reset();
+            }
+            if (record.elementType >= CaelusElementType::last) MX_THROW(std::format("Invalid element type {} in snapshot", record.elementType));
+            style.elementType = static_cast<CaelusElementType>(record.elementType);
+            style.fontSize = DecodeMeasure(record.fontSize);
+            style.backgroundColor.argb(record.backgroundColor);
+            style.textColor.argb(record.textColor);
+            style.fontFace = s.String(record.fontFace);
+            style.fontItalic = record.fontItalic != 0;
+            style.fontWeight = static_cast<int>(record.fontWeight);
+            if (record.label == kNone) style.label.reset();
+            else style.label = std::string{ s.String(record.label) };
+            if (record.alignTextH == kNone) style.alignTextH.reset();
+            else style.alignTextH = DecodeEdge(record.alignTextH);
+            if (record.alignTextV == kNone) style.alignTextV.reset();
+            else style.alignTextV = DecodeEdge(record.alignTextV);
+        }
+
+        uint64_t HashFile(std::filesystem::path const & path)
+        {
+            auto const file = mxi::MappedFile{ path };
+            return mxi::hash_bytes(file.data());
+        }
+    }
+
+    std::filesystem::path Snapshot::GetPath(std::filesystem::path const & document)
+    {
+        auto path = document;
+        path += ".snap";
+        return path;
+    }
+
+    Snapshot::Snapshot(std::filesystem::path const & document) : m_document(document)
+    {
+        auto const path = GetPath(document);
+        if (!std::filesystem::exists(path)) return;
+        m_file = std::make_unique<mxi::MappedFile>(path);
+        auto sections = Sections{};
+        if (m_file->empty() || !sections.Read(m_file->data()))
+        {
+            MX_LOG_WARN(std::format("Ignoring malformed or outdated snapshot {}", path.string()));
+            return;
+        }
+
+        // Every source the window was built from must be unchanged
+        if (HashFile(document) != sections.header->documentHash) return;
+        for (uint32_t n = 0; n < sections.header->sheetCount; ++n)
+        {
+            auto const & sheet = sections.sheets[n];
+            switch (sheet.kind)
+            {
+            case EMBEDDED:
+                if (sections.String(sheet.name) != jass::embedded::kDefaultTheme.name) return;
+                if (mxi::hash_bytes(jass::embedded::kDefaultTheme.source) != sheet.sourceHash) return;
+                break;
+            case LINKED:
+            {
+                auto const linked = std::filesystem::path{ sections.String(sheet.name) };
+                if (!std::filesystem::exists(linked) || HashFile(linked) != sheet.sourceHash) return;
+                break;
+            }
+            case INLINE:
+                break; // part of the document
+            default:
+                return;
+            }
+        }
+        m_current = true;
+    }
+
+    void Snapshot::Write(CaelusWindow & window, std::filesystem::path const & document)
+    {
+        window.ResolveStyles();
+
+        auto w = Writer{};
+        for (auto const & sheet : window.m_styleSheets)
+        {
+            auto record = SheetRecord{};
+            record.sourceHash = sheet->GetSourceHash();
+            if (sheet->IsEmbedded())
+            {
+                record.kind = EMBEDDED;
+                record.name = w.String(sheet->GetName());
+            }
+            else if (!sheet->GetPath().empty())
+            {
+                record.kind = LINKED;
+                record.name = w.String(sheet->GetPath().string());
+            }
+            else
+            {
+                auto const compiled = jass::SerializeRules(sheet->GetSourceHash(), sheet->GetRules());
+                record.kind = INLINE;
+                record.name = w.String(sheet->GetName());
+                record.blobOffset = w.Blob(compiled);
+                record.blobSize = static_cast<uint32_t>(compiled.size());
+            }
+            w.m_sheets.push_back(record);
+        }
+
+        auto inlineRules = std::vector<jass::Rule>{};
+        auto const add = [&](auto const & self, CaelusElement const & element, uint32_t const parent) -> void
+        {
+            auto const index = static_cast<uint32_t>(w.m_elements.size());
+            auto record = ElementRecord{};
+            record.parent = parent;
+            record.tag = w.Atom(element.m_tagname);
+            record.name = w.Optional(element.m_name);
+            record.id = w.Atom(element.m_id);
+            record.text = w.Optional(element.m_text);
+            record.firstClass = static_cast<uint32_t>(w.m_lists.size());
+            record.classCount = static_cast<uint32_t>(element.m_classes.size());
+            for (auto const c : element.m_classes) w.m_lists.push_back(w.Atom(c));
+            record.firstAttribute = static_cast<uint32_t>(w.m_attributes.size());
+            record.attributeCount = static_cast<uint32_t>(element.m_attributes.size());
+            for (size_t n = 0; n < element.m_attributes.size(); ++n)
+            {
+                w.m_attributes.push_back({ w.Atom(element.m_attributes.GetNames()[n]), w.String(element.m_attributes.GetValue(n)) });
+            }
+            record.inlineRule = kNone;
+            if (element.m_styles.size())
+            {
+                record.inlineRule = static_cast<uint32_t>(inlineRules.size());
+                inlineRules.emplace_back(0, 0).styles = element.m_styles;
+            }
+            record.style = w.Style(element.m_style);
+            w.m_elements.push_back(record);
+
+            for (auto const & child : element.Children()) self(self, child, index);
+        };
+        add(add, window, kNone);
+
+        auto header = FileHeader{};
+        if (!inlineRules.empty())
+        {
+            auto const compiled = jass::SerializeRules(0, inlineRules);
+            header.inlineRulesOffset = w.Blob(compiled);
+            header.inlineRulesSize = static_cast<uint32_t>(compiled.size());
+        }
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.documentHash = window.m_sourceHash;
+        header.styleCount = static_cast<uint32_t>(w.m_styles.size());
+        header.sheetCount = static_cast<uint32_t>(w.m_sheets.size());
+        header.elementCount = static_cast<uint32_t>(w.m_elements.size());
+        header.attributeCount = static_cast<uint32_t>(w.m_attributes.size());
+        header.listCount = static_cast<uint32_t>(w.m_lists.size());
+        header.stringCount = static_cast<uint32_t>(w.m_strings.size());
+        header.charCount = static_cast<uint32_t>(w.m_chars.size());
+        header.blobSize = static_cast<uint32_t>(w.m_blobs.size());
+
+        auto out = std::string{};
+        auto const write = [&out](auto const & v)
+        {
+            out.append(reinterpret_cast<char const *>(v.data()), v.size() * sizeof(v[0]));
+        };
+        out.append(reinterpret_cast<char const *>(&header), sizeof(header));
+        write(w.m_styles);
+        write(w.m_sheets);
+        write(w.m_elements);
+        write(w.m_attributes);
+        write(w.m_lists);
+        write(w.m_strings);
+        write(w.m_chars);
+        out.resize(AlignTo8(out.size()));
+        write(w.m_blobs);
+
+        // Written aside and renamed into place, so a window starting meanwhile never maps a partial file
+        auto const path = GetPath(document);
+        auto temp = path;
+        temp += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            auto file = std::ofstream{ temp, std::ios::binary | std::ios::trunc };
+            if (!file) MX_THROW(std::format("Unable to write snapshot: {}", temp.string()));
+            file.write(out.data(), out.size());
+            if (!file) MX_THROW(std::format("Unable to write snapshot: {}", temp.string()));
+        }
+        auto error = std::error_code{};
+        std::filesystem::rename(temp, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temp, error);
+            MX_THROW(std::format("Unable to replace snapshot: {}", path.string()));
+        }
+        MX_LOG_DEBUG(std::format("Wrote snapshot of {} elements and {} styles to {}", header.elementCount, header.styleCount, path.string()));
+    }
+
+    void Snapshot::Restore(CaelusWindow & window)
+    {
+        auto s = Sections{};
+        if (!m_current || !s.Read(m_file->data())) MX_THROW(std::format("Snapshot of {} is not current", m_document.string()));
+
+        for (uint32_t n = 0; n < s.header->sheetCount; ++n)
+        {
+            auto const & sheet = s.sheets[n];
+            switch (sheet.kind)
+            {
+            case EMBEDDED:
+                window.m_styleSheets.push_back(jass::StyleSheet::Load(jass::embedded::kDefaultTheme));
+                break;
+            case LINKED:
+                window.m_styleSheets.push_back(jass::StyleSheet::Load(std::filesystem::path{ s.String(sheet.name) }));
+                break;
+            default:
+                window.m_styleSheets.push_back(std::make_shared<jass::StyleSheet const>(s.String(sheet.name), sheet.sourceHash, s.Blob(sheet.blobOffset, sheet.blobSize)));
+                break;
+            }
+        }
+        window.StyleSheetsChanged();
+
+        auto inlineRules = std::vector<jass::Rule>{};
+        if (s.header->inlineRulesSize && !jass::DeserializeRules(s.Blob(s.header->inlineRulesOffset, s.header->inlineRulesSize), 0, inlineRules))
+        {
+            MX_THROW("Invalid inline styles in snapshot");
+        }
+
+        // The resolved styles are current for the generation the stylesheets just started
+        auto const generation = window.m_styleGeneration;
+        auto elements = std::vector<CaelusElement *>(s.header->elementCount);
+        for (uint32_t n = 0; n < s.header->elementCount; ++n)
+        {
+            auto const & record = s.elements[n];
+            if ((n == 0) != (record.parent == kNone) || (n && record.parent >= n)) MX_THROW("Invalid element order in snapshot");
+            auto const element = n ? window.m_arena.Create() : static_cast<CaelusElement *>(&window);
+            elements[n] = element;
+
+            element->m_tagname = s.Atom(record.tag);
+            if (n) element->m_name = s.Optional(record.name);
+            if (n) elements[record.parent]->LinkChild(element); // once IsText can tell
+            element->m_id = s.Atom(record.id);
+            element->m_text = s.Optional(record.text);
+            for (auto const c : s.Range(s.lists, s.header->listCount, record.firstClass, record.classCount))
+            {
+                element->m_classes.push_back(s.Atom(c));
+            }
+            for (auto const & attribute : s.Range(s.attributes, s.header->attributeCount, record.firstAttribute, record.attributeCount))
+            {
+                element->m_attributes.Borrow(s.Atom(attribute.name), s.String(attribute.value));
+            }
+            if (record.inlineRule != kNone)
+            {
+                if (record.inlineRule >= inlineRules.size()) MX_THROW("Invalid inline style in snapshot");
+                element->m_styles = std::move(inlineRules[record.inlineRule].styles);
+            }
+            if (record.style >= s.header->styleCount) MX_THROW("Invalid style in snapshot");
+            DecodeStyle(s, s.styles[record.style], element->m_style);
+            element->m_style.generation = generation;
+            window.IndexElement(*element);
+        }
+        window.m_resolvedGeneration = generation;
+        window.m_sourceHash = s.header->documentHash;
+        window.m_snapshot = std::move(m_file);
+        m_current = false;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+#include "MxiUtils.h"
+
+namespace Caelus
+{
+    class CaelusWindow;
+
+    // A built window saved to disk: its element tree, inline styles, stylesheets (compiled, or a reference to a
+    // shared one) and every element's resolved style. The file is a header followed by arrays of plain records that
+    // refer to each other by index, never by pointer, so a snapshot is used straight from a read-only mapping and
+    // restoring a window parses nothing. It is keyed by hashes of every source it was built from, so a stale
+    // snapshot is simply ignored.
+    class Snapshot
+    {
+    public:
+        static constexpr uint32_t kVersion = 1;
+
+        // Map the snapshot of document. IsCurrent is false if it is missing, malformed, from another version, or
+        // the document, a stylesheet it links or the built-in theme has changed since it was written.
+        explicit Snapshot(std::filesystem::path const & document);
+        bool IsCurrent() const noexcept { return m_current; }
+        std::filesystem::path const & GetDocument() const noexcept { return m_document; }
+
+        // Resolve window's styles and save it alongside document.
+        static void Write(CaelusWindow & window, std::filesystem::path const & document);
+
+        // Where the snapshot of a document lives.
+        static std::filesystem::path GetPath(std::filesystem::path const & document);
+
+    private:
+        friend class CaelusWindow;
+
+        // Rebuild the window from the snapshot, which must be current. The window takes over the mapping, as
+        // element text and attribute values are views into it.
+        void Restore(CaelusWindow & window);
+
+        std::filesystem::path m_document;
+        std::unique_ptr<mxi::MappedFile> m_file;
+        bool m_current = false;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "MxiLogging.h"
+#include "MxiUtils.h"
+
+#include "jass.h"
+
+#include "CaelusStyle.h"
+
+namespace Caelus
+{
+    using namespace jass;
+
+    void ComputedStyle::Inherit(ComputedStyle const & parent)
+    {
+        // Border width, label, padding, size and tethers are uninheritable
+        backgroundColor = parent.backgroundColor;
+        for (int edge = 0; edge < 4; ++edge)
+        {
+            borderColor[edge] = parent.borderColor[edge];
+            borderRadius[edge] = parent.borderRadius[edge];
+        }
+        elementType = parent.elementType;
+        fontFace = parent.fontFace;
+        fontItalic = parent.fontItalic;
+        fontSize = parent.fontSize;
+        fontWeight = parent.fontWeight;
+        alignTextH = parent.alignTextH;
+        alignTextV = parent.alignTextV;
+        textColor = parent.textColor;
+    }
+
+    bool ComputedStyle::InheritsSameAs(ComputedStyle const & other) const
+    {
+        // Keep in step with Inherit
+        for (int edge = 0; edge < 4; ++edge)
+        {
+            if (borderColor[edge] != other.borderColor[edge] || borderRadius[edge] != other.borderRadius[edge]) return false;
+        }
+        return backgroundColor == other.backgroundColor
+            && elementType == other.elementType
+            && fontFace == other.fontFace
+            && fontItalic == other.fontItalic
+            && fontSize == other.fontSize
+            && fontWeight == other.fontWeight
+            && alignTextH == other.alignTextH
+            && alignTextV == other.alignTextV
+            && textColor == other.textColor;
+    }
+
+    void ComputedStyle::ApplyClass(CaelusClass const & c)
+    {
+        auto const assign = [](auto & target, auto const & v) { if (v.has_value()) target = v.value(); };
+
+        assign(backgroundColor, c.GetStyle<Color>(BACKGROUND_COLOR, 0));
+        for (int edge = 0; edge < 4; ++edge)
+        {
+            assign(borderColor[edge], c.GetStyle<Color>(BORDER_COLOR, edge));
+            assign(borderRadius[edge], c.GetStyle<Measure>(BORDER_RADIUS, edge));
+            assign(borderWidth[edge], c.GetStyle<Measure>(BORDER_WIDTH, edge));
+            assign(padding[edge], c.GetStyle<Measure>(PADDING, edge));
+            assign(tethers[edge], c.GetStyle<Tether>(TETHER, edge));
+        }
+        for (int dim = 0; dim < 2; ++dim)
+        {
+            assign(size[dim], c.GetStyle<Measure>(SIZE, dim));
+        }
+        assign(elementType, c.GetStyle<CaelusElementType>(ELEMENT_TYPE, 0));
+        assign(fontFace, c.GetStyle<std::string>(FONT_FACE, 0));
+        assign(fontItalic, c.GetStyle<bool>(FONT_ITALIC, 0));
+        assign(fontSize, c.GetStyle<Measure>(FONT_SIZE, 0));
+        assign(fontWeight, c.GetStyle<int>(FONT_WEIGHT, 0));
+        assign(label, c.GetStyle<std::string>(LABEL, 0));
+        assign(alignTextH, c.GetStyle<Edge>(TEXT_ALIGNH, 0));
+        assign(alignTextV, c.GetStyle<Edge>(TEXT_ALIGNV, 0));
+        assign(textColor, c.GetStyle<Color>(TEXT_COLOR, 0));
+    }
+
+    void ComputedStyle::Apply(PropertyId const prop, PropertyValue const & value)
+    {
+        // Shorthands were expanded when the declaration was parsed, so only per-edge longhands arrive here
+        switch (prop)
+        {
+        case PropertyId::BACKGROUND_COLOR: backgroundColor = std::get<Color>(value); break;
+        case PropertyId::BORDER_TOP_COLOR: borderColor[TOP] = std::get<Color>(value); break;
+        case PropertyId::BORDER_LEFT_COLOR: borderColor[LEFT] = std::get<Color>(value); break;
+        case PropertyId::BORDER_BOTTOM_COLOR: borderColor[BOTTOM] = std::get<Color>(value); break;
+        case PropertyId::BORDER_RIGHT_COLOR: borderColor[RIGHT] = std::get<Color>(value); break;
+        case PropertyId::BORDER_TOP_WIDTH: borderWidth[TOP] = std::get<Measure>(value); break;
+        case PropertyId::BORDER_LEFT_WIDTH: borderWidth[LEFT] = std::get<Measure>(value); break;
+        case PropertyId::BORDER_BOTTOM_WIDTH: borderWidth[BOTTOM] = std::get<Measure>(value); break;
+        case PropertyId::BORDER_RIGHT_WIDTH: borderWidth[RIGHT] = std::get<Measure>(value); break;
+        case PropertyId::COLOR: textColor = std::get<Color>(value); break;
+        case PropertyId::FONT_FACE: fontFace = std::get<std::string>(value); break;
+        case PropertyId::FONT_SIZE: fontSize = std::get<Measure>(value); break;
+        case PropertyId::HEIGHT:
+            if (std::holds_alternative<Auto>(value)) size[HEIGHT].reset();
+            else size[HEIGHT] = std::get<Measure>(value);
+            break;
+        case PropertyId::WIDTH:
+            if (std::holds_alternative<Auto>(value)) size[WIDTH].reset();
+            else size[WIDTH] = std::get<Measure>(value);
+            break;
+        case PropertyId::PADDING_TOP: padding[TOP] = std::get<Measure>(value); break;
+        case PropertyId::PADDING_LEFT: padding[LEFT] = std::get<Measure>(value); break;
+        case PropertyId::PADDING_BOTTOM: padding[BOTTOM] = std::get<Measure>(value); break;
+        case PropertyId::PADDING_RIGHT: padding[RIGHT] = std::get<Measure>(value); break;
+        case PropertyId::TOP: tethers[TOP] = std::get<Tether>(value); break;
+        case PropertyId::LEFT: tethers[LEFT] = std::get<Tether>(value); break;
+        case PropertyId::BOTTOM: tethers[BOTTOM] = std::get<Tether>(value); break;
+        case PropertyId::RIGHT: tethers[RIGHT] = std::get<Tether>(value); break;
+        default: break; // TODO margin-*, max-width, min-width, position
+        }
+    }
+    ComputedStyle const * StyleSharingCache::Find(Key const & key, uint64_t const generation)
+    {
+        ++m_lookups;
+        for (auto & entry : m_entries)
+        {
+            if (entry.style.generation != generation) continue;
+            if (entry.key.tag != key.tag || entry.key.attributeHash != key.attributeHash || !(entry.key == key)) continue;
+            entry.lastUsed = ++m_clock;
+            ++m_hits;
+            return &entry.style;
+        }
+        return nullptr;
+    }
+
+    void StyleSharingCache::Clear()
+    {
+        for (auto & entry : m_entries)
+        {
+            entry.style.generation = 0;
+        }
+    }
+
+    void StyleSharingCache::Insert(Key && key, ComputedStyle const & style)
+    {
+        auto victim = &m_entries[0];
+        for (auto & entry : m_entries)
+        {
+            if (entry.lastUsed < victim->lastUsed) victim = &entry;
+        }
+        victim->key = std::move(key);
+        victim->style = style;
+        victim->lastUsed = ++m_clock;
+    }
+}
\ No newline at end of file
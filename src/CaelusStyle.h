@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "jass.h"
+
+#include "CaelusClass.h"
+#include "CaelusColor.h"
+#include "CaelusMeasure.h"
+
+namespace Caelus
+{
+    // Fully resolved style of a single element, filled by one cascade pass.
+    class ComputedStyle
+    {
+    public:
+        // Copy the inheritable styles from the parent's computed style.
+        void Inherit(ComputedStyle const & parent);
+
+        // True if children would inherit the same values from other as from this.
+        bool InheritsSameAs(ComputedStyle const & other) const;
+
+        // Apply any styles set on the element's class chain.
+        void ApplyClass(CaelusClass const & c);
+
+        // Apply a single JASS declaration.
+        void Apply(jass::PropertyId prop, jass::PropertyValue const & value);
+
+        Color backgroundColor = "white"_color;
+        Color borderColor[4] = {};
+        Measure borderRadius[4] = {};
+        Measure borderWidth[4] = {};
+        CaelusElementType elementType = GENERIC;
+        std::string fontFace = "Arial";
+        bool fontItalic = false;
+        Measure fontSize = "12pt"_measure;
+        int fontWeight = FontWeight::REGULAR;
+        std::optional<std::string> label;
+        Measure padding[4] = {};
+        std::optional<Measure> size[2];
+        std::optional<Tether> tethers[4];
+        std::optional<Edge> alignTextH = Edge::LEFT;
+        std::optional<Edge> alignTextV = Edge::TOP;
+        Color textColor = "black"_color;
+
+        // Window style generation this was computed for; 0 means never computed.
+        uint64_t generation = 0;
+    };
+    // Small LRU of recently computed styles, so structurally identical siblings (e.g. the rows of a list) reuse
+    // one cascade result instead of each running their own.
+    class StyleSharingCache
+    {
+    public:
+        // Everything that decides an element's cascade when no positional rules are in play.
+        class Key
+        {
+        public:
+            ComputedStyle const * parent;
+            CaelusClass const * caelusClass;
+            mxi::Atom tag;
+            std::vector<mxi::Atom> classes; // sorted
+            uint64_t attributeHash; // includes the inline style attribute
+            bool operator==(Key const &) const = default;
+        };
+
+        static constexpr size_t kCapacity = 16;
+
+        // Returns a style computed for an equal key in this generation, or nullptr.
+        ComputedStyle const * Find(Key const & key, uint64_t const generation);
+        void Insert(Key && key, ComputedStyle const & style);
+        void ResetCounters() noexcept { m_lookups = m_hits = 0; }
+        void Clear();
+
+        uint64_t m_lookups = 0;
+        uint64_t m_hits = 0;
+
+    private:
+        class Entry
+        {
+        public:
+            Key key = {};
+            ComputedStyle style = {};
+            uint64_t lastUsed = 0;
+        };
+        std::array<Entry, kCapacity> m_entries = {};
+        uint64_t m_clock = 0;
+    };
+}
\ No newline at end of file
@@ -1,12 +1,17 @@
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 
 #include "CaelusElement.h"
 #include "jaml.h"
 #include "jass.h"
+#include "jassc.h"
 
 #include "CaelusWindow.h"
+#include "default.jass.h"
 
 namespace Caelus
 {
@@ -79,22 +84,103 @@ namespace Caelus
     }
 
     CaelusWindow::CaelusWindow() : CaelusWindow(std::string_view{ "<jaml><head></head><body></body></jaml>" }) {}
-    CaelusWindow::CaelusWindow(std::string_view const & source) : CaelusElement("window")
+    CaelusWindow::CaelusWindow(std::string_view const & source) : CaelusElement("window"), m_source(source)
     {
+        m_sourceHash = mxi::hash_bytes(m_source);
         Init();
-        JamlParser(source, *this);
+        auto builder = JamlDomBuilder{ *this };
+        JamlParser{ m_source, builder }.Parse();
         BuildAll();
     }
 
-    CaelusWindow::CaelusWindow(std::filesystem::path const & file) : CaelusElement("window")
+    CaelusWindow::CaelusWindow(std::filesystem::path const & file) : CaelusElement("window"), m_path(file)
     {
-        auto const source = mxi::file_get_contents(file);
+        m_source = mxi::file_get_contents(file);
+        m_sourceHash = mxi::hash_bytes(m_source);
 
         Init();
-        JamlParser(std::string_view{ source }, *this);
+        auto builder = JamlDomBuilder{ *this };
+        JamlParser{ m_source, builder }.Parse();
         BuildAll();
     }
 
+    CaelusWindow::CaelusWindow(Snapshot && snapshot) : CaelusElement("window"), m_path(snapshot.GetDocument())
+    {
+        if (!snapshot.IsCurrent()) MX_THROW(std::format("Snapshot of {} is not current", m_path.string()));
+
+        // Inline styles and stylesheets come from the snapshot, so there is nothing left for BuildAll to do
+        Init();
+        try
+        {
+            snapshot.Restore(*this);
+        }
+        catch (...)
+        {
+            DestroyChildren(m_arena);
+            throw;
+        }
+    }
+
+    std::unique_ptr<CaelusWindow> CaelusWindow::Load(std::filesystem::path const & file)
+    {
+        auto const started = std::chrono::steady_clock::now();
+        auto const elapsed = [&]()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        };
+
+        // Scoped so that a stale snapshot is unmapped before it is replaced
+        {
+            auto snapshot = Snapshot{ file };
+            if (snapshot.IsCurrent())
+            {
+                try
+                {
+                    auto window = std::make_unique<CaelusWindow>(std::move(snapshot));
+                    MX_LOG_DEBUG(std::format("Restored {} from its snapshot in {}us", file.string(), elapsed()));
+                    return window;
+                }
+                catch (std::exception const & err)
+                {
+                    MX_LOG_WARN(std::format("Ignoring snapshot of {}: {}", file.string(), err.what()));
+                }
+            }
+        }
+
+        auto window = std::make_unique<CaelusWindow>(file);
+        MX_LOG_DEBUG(std::format("Parsed {} in {}us", file.string(), elapsed()));
+        try
+        {
+            Snapshot::Write(*window, file);
+        }
+        catch (std::exception const & err)
+        {
+            MX_LOG_WARN(std::format("Unable to snapshot {}: {}", file.string(), err.what()));
+        }
+        return window;
+    }
+
+    CaelusWindow::~CaelusWindow()
+    {
+        // The arena only frees its blocks; the elements in them must be destroyed first
+        DestroyChildren(m_arena);
+    }
+
+    std::vector<std::unique_ptr<CaelusWindow>> CaelusWindow::LoadAll(std::span<std::filesystem::path const> const files)
+    {
+        auto windows = std::vector<std::unique_ptr<CaelusWindow>>(files.size());
+        mxi::parallel_for(files.size(), [&](size_t const n) { windows[n] = std::make_unique<CaelusWindow>(files[n]); });
+        return windows;
+    }
+
+    std::pair<size_t, size_t> CaelusWindow::Locate(std::string_view const & text) const
+    {
+        auto const le = std::less_equal<>{};
+        if (!le(m_source.data(), text.data()) || !le(text.data() + text.size(), m_source.data() + m_source.size())) return {};
+        if (!m_lines) m_lines = std::make_unique<mxi::LineIndex>(m_source);
+        return m_lines->Locate(static_cast<size_t>(text.data() - m_source.data()));
+    }
+
     void CaelusWindow::IgnoreErrors(bool const ignore)
     {
         m_throwOnUnresolved = !ignore;
@@ -102,41 +188,159 @@ namespace Caelus
 
     void CaelusWindow::BuildAll()
     {
-
-        for (auto & child : m_children)
+        static auto const kHead = mxi::intern("head");
+        static auto const kBody = mxi::intern("body");
+        static auto const kStyle = mxi::intern("style");
+        static auto const kLink = mxi::intern("link");
+        static auto const kHref = mxi::intern("href");
+        static auto const kRel = mxi::intern("rel");
+
+        // The built-in theme comes first so that document styles win ties against it
+        m_styleSheets.push_back(StyleSheet::Load(jass::embedded::kDefaultTheme));
+
+        size_t styleBlocks = 0;
+        for (auto & child : Children())
         {
             child.Build();
-            if (child.m_tagname == "head")
+            if (child.m_tagname == kHead)
             {
-                for (auto tag : child.m_children)
+                for (auto const & tag : child.Children())
                 {
-                    if (tag.m_tagname == "style")
+                    if (tag.m_tagname == kStyle)
                     {
-                        JassParser{ tag.m_text, m_rules };
+                        // Style blocks belong to this document, so are not shared
+                        auto const cachePath = m_path.empty() ? std::filesystem::path{} : GetCompiledPath(m_path, styleBlocks);
+                        auto const name = std::format("{}<style {}>", m_path.string(), styleBlocks);
+                        m_styleSheets.push_back(std::make_shared<StyleSheet const>(name, tag.m_text, cachePath));
+                        ++styleBlocks;
                     }
-                    else if (tag.m_tagname == "link")
+                    else if (tag.m_tagname == kLink)
                     {
-                        auto const href = std::filesystem::path(tag.m_attributes["href"]);
+                        auto const href = std::filesystem::path(tag.m_attributes.Get(kHref));
                         if (href.empty() || !std::filesystem::exists(href))
                         {
                             MX_LOG_WARN(std::format("Link file not found: {}", href));
                         }
                         else
                         {
-                            if (tag.m_attributes["rel"] == "stylesheet" || href.extension() == ".css")
+                            if (tag.m_attributes.Get(kRel) == "stylesheet" || href.extension() == ".css")
                             {
-                                auto const css = mxi::file_get_contents(href);
-                                JassParser{ css, m_rules };
+                                m_styleSheets.push_back(StyleSheet::Load(href));
                             }
                         }
                     }
                 }
             }
-            else if (child.m_tagname != "body")
+            else if (child.m_tagname != kBody)
             {
-                MX_THROW("Unexpected tag \"{}\". Expected \"head\" or \"body\".", child.m_tagname);
+                MX_THROW("Unexpected tag \"{}\". Expected \"head\" or \"body\".", mxi::atom_name(child.m_tagname));
             }
         }
+
+        StyleSheetsChanged();
+    }
+
+    void CaelusWindow::AddStyleSheet(jass::EmbeddedStyleSheet const & sheet)
+    {
+        m_styleSheets.push_back(StyleSheet::Load(sheet));
+        StyleSheetsChanged();
+    }
+
+    void CaelusWindow::EnableProfiling(bool const enable)
+    {
+        if (!enable) m_profiler.reset();
+        else if (!m_profiler)
+        {
+            m_profiler = std::make_unique<jass::RuleProfiler>();
+            m_profiler->Retain(m_styleSheets);
+        }
+    }
+
+    void CaelusWindow::WriteProfile(std::filesystem::path const & path) const
+    {
+        if (!m_profiler) MX_THROW("Profiling is not enabled.");
+        auto const format = (path.extension() == ".csv") ? jass::RuleProfiler::CSV : jass::RuleProfiler::JSON;
+        auto out = std::ofstream{ path, std::ios::binary | std::ios::trunc };
+        if (!out) MX_THROW(std::format("Unable to write profile: {}", path.string()));
+        out << m_profiler->Report(m_styleSheets, format);
+    }
+
+    void CaelusWindow::StyleSheetsChanged()
+    {
+        m_invalidationSets.Clear();
+        m_positionalRules = false;
+        for (auto const & sheet : m_styleSheets)
+        {
+            m_invalidationSets.Merge(sheet->GetInvalidationSets());
+            m_positionalRules |= sheet->GetIndex().HasPositionalRules();
+        }
+        if (m_profiler) m_profiler->Retain(m_styleSheets);
+        InvalidateStyles();
+    }
+
+    namespace
+    {
+        template<typename Map>
+        void EraseEntry(Map & map, typename Map::key_type const & key, CaelusElement const * const element) noexcept
+        {
+            auto const [first, last] = map.equal_range(key);
+            for (auto it = first; it != last; ++it)
+            {
+                if (it->second == element) { map.erase(it); return; }
+            }
+        }
+    }
+
+    void CaelusWindow::IndexElement(CaelusElement & element)
+    {
+        if (!element.m_parent) return; // the window finds itself
+        if (!element.m_name.empty())
+        {
+            m_elementsByName.emplace(element.m_name, &element);
+            auto & siblings = element.m_parent->m_childNames;
+            if (!siblings) siblings = std::make_unique<std::unordered_multimap<std::string_view, CaelusElement *>>();
+            siblings->emplace(element.m_name, &element);
+        }
+        if (element.m_id) m_elementsById.emplace(element.m_id, &element);
+    }
+
+    void CaelusWindow::UnindexElement(CaelusElement & element) noexcept
+    {
+        if (!element.m_parent) return;
+        if (!element.m_name.empty())
+        {
+            EraseEntry(m_elementsByName, element.m_name, &element);
+            if (element.m_parent->m_childNames) EraseEntry(*element.m_parent->m_childNames, element.m_name, &element);
+        }
+        if (element.m_id) EraseEntry(m_elementsById, element.m_id, &element);
+    }
+
+    void CaelusWindow::UnindexTree(CaelusElement & element) noexcept
+    {
+        for (auto & child : element.Children()) UnindexTree(child);
+        UnindexElement(element);
+    }
+
+    void CaelusWindow::InvalidateStyles()
+    {
+        ++m_styleGeneration;
+    }
+
+    void CaelusWindow::ResolveStyles()
+    {
+        auto filter = std::make_unique<AncestorFilter>();
+        auto const full = m_resolvedGeneration != m_styleGeneration;
+        m_styleSharing.ResetCounters();
+        m_restyleCount = 0;
+        CaelusElement::ResolveStyles(*filter, m_styleGeneration, full);
+        m_resolvedGeneration = m_styleGeneration;
+#ifdef _DEBUG
+        // Every marked element in the tree was just restyled, so any still pending belonged to a removed one
+        if (m_pendingRestyles) MX_THROW(std::format("{} restyles pending after ResolveStyles", m_pendingRestyles));
+#endif
+        MX_LOG_DEBUG(std::format("Restyled {} elements ({})", m_restyleCount, full ? "full" : "incremental"));
+        MX_LOG_DEBUG(std::format("Ancestor filter rejected {} of {} candidate rules", filter->m_rejects, filter->m_tests));
+        MX_LOG_DEBUG(std::format("Style sharing reused {} of {} styles", m_styleSharing.m_hits, m_styleSharing.m_lookups));
     }
 
     void CaelusWindow::FitToInner(HWND inner)
@@ -228,6 +432,7 @@ namespace Caelus
 
     void CaelusWindow::Relayout(int const width, int const height)
     {
+        ResolveStyles();
         PrepareToComputeLayout();
 
         m_futureRect.SetEdge(Edge::TOP, 0);
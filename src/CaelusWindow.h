@@ -1,8 +1,17 @@
 #pragma once
 
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "jaml.h"
+#include "jassc.h"
 #include "CaelusClass.h"
 #include "CaelusElement.h"
+#include "CaelusSnapshot.h"
 
 namespace Caelus
 {
@@ -12,10 +21,21 @@ namespace Caelus
     class CaelusWindow : public CaelusElement
     {
         friend class CaelusElement;
+        friend class JamlDomBuilder;
+        friend class Snapshot;
     public:
         CaelusWindow();
         CaelusWindow(std::filesystem::path const & file);
         CaelusWindow(std::string_view const & source);
+        explicit CaelusWindow(Snapshot && snapshot); // throws unless the snapshot is current
+        ~CaelusWindow();
+
+        // Restore the window for file from its snapshot if that is current, otherwise parse it and write one.
+        static std::unique_ptr<CaelusWindow> Load(std::filesystem::path const & file);
+
+        // Construct a window for each file, parsing the documents and their stylesheets in parallel. Call Register
+        // and Start on the UI thread as usual afterwards.
+        static std::vector<std::unique_ptr<CaelusWindow>> LoadAll(std::span<std::filesystem::path const> const files);
         LRESULT WndProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam);
         static void Register(HINSTANCE hInstance);
         int Start(HINSTANCE hInstance, int const nCmdShow, int const x = 100, int const y = 100, int width = 640, int height = 480);
@@ -24,12 +44,52 @@ namespace Caelus
         void SetResizable(bool const resizable = true);
         static void FitToInner(HWND inner);
 
+        // Zero-based line and column of text within the document source, or 0,0 if it is not a view into it.
+        std::pair<size_t, size_t> Locate(std::string_view const & text) const;
+        void AddStyleSheet(jass::EmbeddedStyleSheet const & sheet); // e.g. one generated by tools/jassgen
+        void InvalidateStyles();
+        void ResolveStyles();
+        StyleSharingCache const & GetStyleSharingCache() const noexcept { return m_styleSharing; }
+        size_t GetRestyleCount() const noexcept { return m_restyleCount; }
+
+        // Per-rule match counts and timings, accumulated over every cascade while enabled.
+        void EnableProfiling(bool const enable = true);
+        jass::RuleProfiler const * GetProfiler() const noexcept { return m_profiler.get(); }
+        void WriteProfile(std::filesystem::path const & path) const; // CSV for a .csv path, otherwise JSON
+
     protected:
-        std::vector<jass::Rule> m_rules = {};
+        ElementArena m_arena = {}; // every element below the window; declared first so it is destroyed last
+        std::string m_source = {}; // the document; element text and attributes view into it
+        uint64_t m_sourceHash = 0; // mxi::hash_bytes(m_source), which the source is not kept for when restored
+        std::unique_ptr<mxi::MappedFile> m_snapshot = {}; // if restored, viewed by element text and attributes
+        mutable std::unique_ptr<mxi::LineIndex> m_lines = {}; // of m_source; made by the first Locate
+        std::deque<std::string> m_unescaped = {}; // text and attributes that had entity references, viewed likewise
+        std::vector<std::shared_ptr<jass::StyleSheet const>> m_styleSheets = {}; // in cascade order
+        bool m_positionalRules = false; // any sheet's RuleIndex::HasPositionalRules
+        std::filesystem::path m_path = {}; // source document, if loaded from a file
+
+        // Bumped whenever rules, classes or attributes change; computed styles from an older generation are stale.
+        uint64_t m_styleGeneration = 1;
+        uint64_t m_resolvedGeneration = 0; // generation of the last full ResolveStyles pass
+        jass::InvalidationSets m_invalidationSets = {}; // merged from every sheet
+        mutable StyleSharingCache m_styleSharing = {};
+        mutable size_t m_pendingRestyles = 0; // elements marked for restyle
+        mutable size_t m_restyleCount = 0; // cascades run since the last ResolveStyles pass began
+        mutable std::unique_ptr<jass::RuleProfiler> m_profiler = {}; // null unless profiling
+
+        // Every element below the window with a name or id. Keys view the elements' own names. Kept up to date by
+        // whatever links, unlinks or renames elements: AppendChild, InsertChild, RemoveChild, SetAttribute, the
+        // parser and snapshots.
+        std::unordered_multimap<std::string_view, CaelusElement *> m_elementsByName = {};
+        std::unordered_multimap<mxi::Atom, CaelusElement *> m_elementsById = {};
 
     private:
         CaelusWindow(CaelusWindow const &) = delete;
         void BuildAll();
+        void StyleSheetsChanged();
+        void IndexElement(CaelusElement & element); // once it is linked and its name and id are set
+        void UnindexElement(CaelusElement & element) noexcept;
+        void UnindexTree(CaelusElement & element) noexcept; // element and its descendants, before removing them
         void FitToOuter();
         bool m_throwOnUnresolved = true;
         bool m_resizable = false;
@@ -1,5 +1,6 @@
 #include "sqlite3/sqlite3.h"
 #include "Config.h"
+#include "MxiLogging.h"
 #include "MxiUtils.h"
 
 #include "Caelus.h"
@@ -20,6 +21,7 @@ namespace mx
 
     int Limb::Start(HINSTANCE hInstance, int nCmdShow)
     {
+        mxi::init_logger(GetRelPath("LegoInventoryManager2.log"));
         Config::Load();
         db.Open(GetRelPath("inventory.sqlite"));
         db.GetVersion();
@@ -32,7 +34,7 @@ namespace mx
 
     void Limb::BuildGui()
     {
-        gui = new CaelusWindow(GetRelPath("resource\\search.anus"));
+        gui = CaelusWindow::Load(GetRelPath("resource\\search.anus")).release();
         gui->SetLabel("Lego Inventory Manager 2");
     }
 }
\ No newline at end of file
@@ -0,0 +1,69 @@
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MxiLogging.h"
+#include "MxiUtils.h"
+
+#include "MxiAtom.h"
+
+namespace mxi
+{
+    namespace
+    {
+        class AtomTable
+        {
+        public:
+            std::shared_mutex mutex;
+            std::deque<std::string> strings = { std::string{} }; // deque keeps views stable as it grows
+            std::vector<std::string_view> names = { std::string_view{} };
+            std::unordered_map<std::string_view, Atom> atoms = {};
+        };
+
+        AtomTable & table()
+        {
+            static AtomTable t;
+            return t;
+        }
+    }
+
+    Atom intern(std::string_view const & s)
+    {
+        if (s.empty()) return kNullAtom;
+        auto & t = table();
+        {
+            auto const lock = std::shared_lock{ t.mutex };
+            auto const found = t.atoms.find(s);
+            if (found != t.atoms.end()) return found->second;
+        }
+        auto const lock = std::unique_lock{ t.mutex };
+        auto const found = t.atoms.find(s);
+        if (found != t.atoms.end()) return found->second;
+        auto const atom = static_cast<Atom>(t.names.size());
+        if (atom == 0) MX_THROW("Atom table exhausted");
+        auto const & stored = t.strings.emplace_back(s);
+        t.names.push_back(stored);
+        t.atoms.emplace(stored, atom);
+        return atom;
+    }
+
+    Atom find_atom(std::string_view const & s)
+    {
+        if (s.empty()) return kNullAtom;
+        auto & t = table();
+        auto const lock = std::shared_lock{ t.mutex };
+        auto const found = t.atoms.find(s);
+        return (found != t.atoms.end()) ? found->second : kNullAtom;
+    }
+
+    std::string_view atom_name(Atom const atom)
+    {
+        auto & t = table();
+        auto const lock = std::shared_lock{ t.mutex };
+        if (atom >= t.names.size()) MX_THROW(std::format("Unknown atom {}", atom));
+        return t.names[atom];
+    }
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace mxi
+{
+    // Process-wide interned string handle. Equal strings always intern to the same atom, so
+    // comparing names is an integer comparison. The empty string is always kNullAtom.
+    using Atom = uint32_t;
+    static constexpr Atom kNullAtom = 0;
+
+    // Intern a string, returning its atom.
+    Atom intern(std::string_view const & s);
+
+    // Look up the atom for a string without interning it. Returns kNullAtom if it was never interned.
+    Atom find_atom(std::string_view const & s);
+
+    // Get the string an atom was interned from. The view remains valid for the life of the process.
+    std::string_view atom_name(Atom const atom);
+}
\ No newline at end of file
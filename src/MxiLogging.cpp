@@ -1,14 +1,49 @@
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+#include <Windows.h>
+
 #include "MxiLogging.h"
 
 namespace mxi
 {
+    namespace
+    {
+        constexpr char const * kLevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+
+        std::mutex logMutex;
+        std::ofstream logFile;
+    }
+
     void init_logger(std::filesystem::path const & path)
     {
-        // TODO
+        auto const lock = std::scoped_lock{ logMutex };
+        if (logFile.is_open()) logFile.close();
+        logFile.open(path, std::ios::out | std::ios::app);
     }
 
     void log(LogLevel const & level, std::string_view const & message)
     {
-        // TODO
+#ifndef _DEBUG
+        // Debug messages carry timings and per-pass counters; release builds only keep the rest.
+        if (level == LogLevel::Debug) return;
+#endif
+        auto const now = std::chrono::floor<std::chrono::milliseconds>(std::chrono::system_clock::now());
+        auto const line = std::format("{:%F %T} [{}] {}\n", now, kLevelNames[level], message);
+
+        auto const lock = std::scoped_lock{ logMutex };
+        OutputDebugStringA(line.c_str());
+        if (logFile.is_open())
+        {
+            logFile << line;
+            logFile.flush();
+        }
+        else
+        {
+            std::clog << line;
+        }
     }
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 #include <Windows.h>
 
@@ -105,6 +111,100 @@ namespace mxi
         return source;
     }
 
+    std::pair<size_t, size_t> LineIndex::Locate(size_t const offset) const
+    {
+        if (!m_built)
+        {
+            auto const begin = m_text.data();
+            auto const end = begin + m_text.size();
+            for (auto p = begin; p != end; ++p)
+            {
+                p = static_cast<char const *>(std::memchr(p, '\n', end - p));
+                if (!p) break;
+                m_newlines.push_back(static_cast<size_t>(p - begin));
+            }
+            m_built = true;
+        }
+
+        // The line is the number of newlines before offset; the column counts from the last of them
+        auto const line = static_cast<size_t>(std::lower_bound(m_newlines.begin(), m_newlines.end(), offset) - m_newlines.begin());
+        auto const col = line ? offset - m_newlines[line - 1] - 1 : offset;
+        return { line, col };
+    }
+
+    MappedFile::MappedFile(std::filesystem::path const & path)
+    {
+        auto const file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+        m_file = file;
+
+        auto size = LARGE_INTEGER{};
+        if (!GetFileSizeEx(file, &size) || !size.QuadPart) return;
+
+        m_mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!m_mapping) return;
+
+        m_view = static_cast<char const *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_view) m_size = static_cast<size_t>(size.QuadPart);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_view) UnmapViewOfFile(m_view);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file) CloseHandle(m_file);
+    }
+
+    uint64_t hash_bytes(std::string_view const & s)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (auto const c : s)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    void parallel_for(size_t const count, std::function<void(size_t)> const & fn)
+    {
+        auto const threads = std::min<size_t>(count, (std::max)(1u, std::thread::hardware_concurrency()));
+        if (threads <= 1)
+        {
+            for (size_t n = 0; n < count; ++n) fn(n);
+            return;
+        }
+
+        auto next = std::atomic<size_t>{ 0 };
+        auto failed = std::atomic<bool>{ false };
+        auto error = std::exception_ptr{};
+        auto errorMutex = std::mutex{};
+        auto const work = [&]()
+        {
+            for (auto n = next++; n < count && !failed; n = next++)
+            {
+                try
+                {
+                    fn(n);
+                }
+                catch (...)
+                {
+                    auto const lock = std::scoped_lock{ errorMutex };
+                    if (!error) error = std::current_exception();
+                    failed = true;
+                }
+            }
+        };
+        {
+            // This thread takes a share of the work too
+            auto pool = std::vector<std::jthread>{};
+            pool.reserve(threads - 1);
+            for (size_t t = 1; t < threads; ++t) pool.emplace_back(work);
+            work();
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
     bool json_escape_needed(unsigned char const c)
     {
         return (c < 0x1F || c == 0x7F || c == '"' || c == '\\');
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <optional>
 #include <source_location>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #define MX_THROW(message) { throw std::runtime_error(mxi::formatError(message).str()); }
@@ -91,6 +94,67 @@ namespace mxi
     // Read entire file into memory.
     std::string file_get_contents(std::filesystem::path const & path);
 
+    // Converts byte offsets in a text to zero-based line and column for diagnostics, so parsers need only track the
+    // offset. The table of newline offsets is built on the first lookup.
+    class LineIndex
+    {
+    public:
+        explicit LineIndex(std::string_view const & text) noexcept : m_text(text) {}
+        std::pair<size_t, size_t> Locate(size_t const offset) const;
+
+    private:
+        std::string_view m_text;
+        mutable std::vector<size_t> m_newlines = {};
+        mutable bool m_built = false;
+    };
+
+    // Read-only memory mapping of an entire file. Empty if the file could not be opened. The file may be renamed
+    // over or deleted while mapped, so a cache or snapshot in use can still be replaced.
+    class MappedFile
+    {
+    public:
+        MappedFile(std::filesystem::path const & path);
+        ~MappedFile();
+        MappedFile(MappedFile const &) = delete;
+        std::string_view data() const noexcept { return { m_view, m_size }; }
+        bool empty() const noexcept { return !m_view; }
+
+    private:
+        void * m_file = nullptr;
+        void * m_mapping = nullptr;
+        char const * m_view = nullptr;
+        size_t m_size = 0;
+    };
+
+    // 64-bit FNV-1a hash of a byte string.
+    uint64_t hash_bytes(std::string_view const & s);
+
+    // Call fn(0) .. fn(count - 1) across up to one thread per core, returning once every call has. The first
+    // exception thrown is rethrown here, and indices not yet started by then are skipped.
+    void parallel_for(size_t const count, std::function<void(size_t)> const & fn);
+
+    // Scan an unsigned decimal (N or N.F) starting at pos, advancing pos past it. Usable at compile time.
+    constexpr std::optional<double> scan_decimal(std::string_view const & s, size_t & pos)
+    {
+        auto const isDigit = [&s](size_t const i) { return i < s.size() && s[i] >= '0' && s[i] <= '9'; };
+        if (!isDigit(pos)) return std::nullopt;
+
+        auto whole = 0.0;
+        while (isDigit(pos)) whole = whole * 10 + (s[pos++] - '0');
+        if (pos >= s.size() || s[pos] != '.') return whole;
+        if (!isDigit(pos + 1)) return std::nullopt;
+
+        ++pos;
+        auto fraction = 0.0;
+        auto scale = 1.0;
+        while (isDigit(pos))
+        {
+            fraction = fraction * 10 + (s[pos++] - '0');
+            scale *= 10;
+        }
+        return whole + fraction / scale;
+    }
+
     std::ostringstream formatError(std::string_view const & message, std::source_location const && source = {});
 
     // Join a vector of strings (or string_views) into a single string.
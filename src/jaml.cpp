@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <format>
 
 #include "MxiLogging.h"
@@ -22,28 +28,190 @@ namespace Caelus
             }
             return false;
         }
-    }
 
-    void JamlParser::RememberPos(bool const stash)
-    {
-        static size_t savedPos = 0;
-        static size_t savedCol = 0;
-        static size_t savedLine = 0;
-        if (stash)
+        class Entity
+        {
+        public:
+            std::string_view name;
+            char32_t codepoint;
+        };
+
+        constexpr Entity kEntities[] = {
+            { "amp", U'&' }, { "lt", U'<' }, { "gt", U'>' }, { "quot", U'"' }, { "apos", U'\'' }, { "Tab", U'\t' },
+            { "NewLine", U'\n' }, { "tab", U'\t' }, { "newline", U'\n' }, { "nbsp", 160 }, { "iexcl", 161 },
+            { "cent", 162 }, { "pound", 163 }, { "curren", 164 }, { "yen", 165 }, { "brvbar", 166 }, { "sect", 167 },
+            { "uml", 168 }, { "copy", 169 }, { "ordf", 170 }, { "laquo", 171 }, { "not", 172 }, { "shy", 173 },
+            { "reg", 174 }, { "macr", 175 }, { "deg", 176 }, { "plusmn", 177 }, { "sup2", 178 }, { "sup3", 179 },
+            { "acute", 180 }, { "micro", 181 }, { "para", 182 }, { "middot", 183 }, { "cedil", 184 }, { "sup1", 185 },
+            { "ordm", 186 }, { "raquo", 187 }, { "frac14", 188 }, { "frac12", 189 }, { "frac34", 190 },
+            { "iquest", 191 }, { "Agrave", 192 }, { "Aacute", 193 }, { "Acirc", 194 }, { "Atilde", 195 },
+            { "Auml", 196 }, { "Aring", 197 }, { "AElig", 198 }, { "Ccedil", 199 }, { "Egrave", 200 },
+            { "Eacute", 201 }, { "Ecirc", 202 }, { "Euml", 203 }, { "Igrave", 204 }, { "Iacute", 205 },
+            { "Icirc", 206 }, { "Iuml", 207 }, { "ETH", 208 }, { "Ntilde", 209 }, { "Ograve", 210 }, { "Oacute", 211 },
+            { "Ocirc", 212 }, { "Otilde", 213 }, { "Ouml", 214 }, { "times", 215 }, { "Oslash", 216 },
+            { "Ugrave", 217 }, { "Uacute", 218 }, { "Ucirc", 219 }, { "Uuml", 220 }, { "Yacute", 221 },
+            { "THORN", 222 }, { "szlig", 223 }, { "agrave", 224 }, { "aacute", 225 }, { "acirc", 226 },
+            { "atilde", 227 }, { "auml", 228 }, { "aring", 229 }, { "aelig", 230 }, { "ccedil", 231 },
+            { "egrave", 232 }, { "eacute", 233 }, { "ecirc", 234 }, { "euml", 235 }, { "igrave", 236 },
+            { "iacute", 237 }, { "icirc", 238 }, { "iuml", 239 }, { "eth", 240 }, { "ntilde", 241 }, { "ograve", 242 },
+            { "oacute", 243 }, { "ocirc", 244 }, { "otilde", 245 }, { "ouml", 246 }, { "divide", 247 },
+            { "oslash", 248 }, { "ugrave", 249 }, { "uacute", 250 }, { "ucirc", 251 }, { "uuml", 252 },
+            { "yacute", 253 }, { "thorn", 254 }, { "yuml", 255 }, { "Amacr", 256 }, { "amacr", 257 }, { "Abreve", 258 },
+            { "abreve", 259 }, { "Aogon", 260 }, { "aogon", 261 }, { "Cacute", 262 }, { "cacute", 263 },
+            { "Ccirc", 264 }, { "ccirc", 265 }, { "Cdot", 266 }, { "cdot", 267 }, { "Ccaron", 268 }, { "ccaron", 269 },
+            { "Dcaron", 270 }, { "dcaron", 271 }, { "Dstrok", 272 }, { "dstrok", 273 }, { "Emacr", 274 },
+            { "emacr", 275 }, { "Ebreve", 276 }, { "ebreve", 277 }, { "Edot", 278 }, { "edot", 279 }, { "Eogon", 280 },
+            { "eogon", 281 }, { "Ecaron", 282 }, { "ecaron", 283 }, { "Gcirc", 284 }, { "gcirc", 285 },
+            { "Gbreve", 286 }, { "gbreve", 287 }, { "Gdot", 288 }, { "gdot", 289 }, { "Gcedil", 290 },
+            { "gcedil", 291 }, { "Hcirc", 292 }, { "hcirc", 293 }, { "Hstrok", 294 }, { "hstrok", 295 },
+            { "Itilde", 296 }, { "itilde", 297 }, { "Imacr", 298 }, { "imacr", 299 }, { "Ibreve", 300 },
+            { "ibreve", 301 }, { "Iogon", 302 }, { "iogon", 303 }, { "Idot", 304 }, { "inodot", 305 }, { "IJlig", 306 },
+            { "ijlig", 307 }, { "Jcirc", 308 }, { "jcirc", 309 }, { "Kcedil", 310 }, { "kcedil", 311 },
+            { "kgreen", 312 }, { "Lacute", 313 }, { "lacute", 314 }, { "Lcedil", 315 }, { "lcedil", 316 },
+            { "Lcaron", 317 }, { "lcaron", 318 }, { "Lmidot", 319 }, { "lmidot", 320 }, { "Lstrok", 321 },
+            { "lstrok", 322 }, { "Nacute", 323 }, { "nacute", 324 }, { "Ncedil", 325 }, { "ncedil", 326 },
+            { "Ncaron", 327 }, { "ncaron", 328 }, { "napos", 329 }, { "ENG", 330 }, { "eng", 331 }, { "Omacr", 332 },
+            { "omacr", 333 }, { "Obreve", 334 }, { "obreve", 335 }, { "Odblac", 336 }, { "odblac", 337 },
+            { "OElig", 338 }, { "oelig", 339 }, { "Racute", 340 }, { "racute", 341 }, { "Rcedil", 342 },
+            { "rcedil", 343 }, { "Rcaron", 344 }, { "rcaron", 345 }, { "Sacute", 346 }, { "sacute", 347 },
+            { "Scirc", 348 }, { "scirc", 349 }, { "Scedil", 350 }, { "scedil", 351 }, { "Scaron", 352 },
+            { "scaron", 353 }, { "Tcedil", 354 }, { "tcedil", 355 }, { "Tcaron", 356 }, { "tcaron", 357 },
+            { "Tstrok", 358 }, { "tstrok", 359 }, { "Utilde", 360 }, { "utilde", 361 }, { "Umacr", 362 },
+            { "umacr", 363 }, { "Ubreve", 364 }, { "ubreve", 365 }, { "Uring", 366 }, { "uring", 367 },
+            { "Udblac", 368 }, { "udblac", 369 }, { "Uogon", 370 }, { "uogon", 371 }, { "Wcirc", 372 },
+            { "wcirc", 373 }, { "Ycirc", 374 }, { "ycirc", 375 }, { "Yuml", 376 }, { "fnof", 402 }, { "circ", 710 },
+            { "tilde", 732 }, { "Alpha", 913 }, { "Beta", 914 }, { "Gamma", 915 }, { "Delta", 916 }, { "Epsilon", 917 },
+            { "Zeta", 918 }, { "Eta", 919 }, { "Theta", 920 }, { "Iota", 921 }, { "Kappa", 922 }, { "Lambda", 923 },
+            { "Mu", 924 }, { "Nu", 925 }, { "Xi", 926 }, { "Omicron", 927 }, { "Pi", 928 }, { "Rho", 929 },
+            { "Sigma", 931 }, { "Tau", 932 }, { "Upsilon", 933 }, { "Phi", 934 }, { "Chi", 935 }, { "Psi", 936 },
+            { "Omega", 937 }, { "alpha", 945 }, { "beta", 946 }, { "gamma", 947 }, { "delta", 948 }, { "epsilon", 949 },
+            { "zeta", 950 }, { "eta", 951 }, { "theta", 952 }, { "iota", 953 }, { "kappa", 954 }, { "lambda", 955 },
+            { "mu", 956 }, { "nu", 957 }, { "xi", 958 }, { "omicron", 959 }, { "pi", 960 }, { "rho", 961 },
+            { "sigmaf", 962 }, { "sigma", 963 }, { "tau", 964 }, { "upsilon", 965 }, { "phi", 966 }, { "chi", 967 },
+            { "psi", 968 }, { "omega", 969 }, { "thetasym", 977 }, { "upsih", 978 }, { "piv", 982 }, { "ensp", 8194 },
+            { "emsp", 8195 }, { "thinsp", 8201 }, { "zwnj", 8204 }, { "zwj", 8205 }, { "lrm", 8206 }, { "rlm", 8207 },
+            { "ndash", 8211 }, { "mdash", 8212 }, { "lsquo", 8216 }, { "rsquo", 8217 }, { "sbquo", 8218 },
+            { "ldquo", 8220 }, { "rdquo", 8221 }, { "bdquo", 8222 }, { "dagger", 8224 }, { "Dagger", 8225 },
+            { "bull", 8226 }, { "hellip", 8230 }, { "permil", 8240 }, { "prime", 8242 }, { "Prime", 8243 },
+            { "lsaquo", 8249 }, { "rsaquo", 8250 }, { "oline", 8254 }, { "euro", 8364 }, { "trade", 8482 },
+            { "larr", 8592 }, { "uarr", 8593 }, { "rarr", 8594 }, { "darr", 8595 }, { "harr", 8596 }, { "crarr", 8629 },
+            { "forall", 8704 }, { "part", 8706 }, { "exist", 8707 }, { "empty", 8709 }, { "nabla", 8711 },
+            { "isin", 8712 }, { "notin", 8713 }, { "ni", 8715 }, { "prod", 8719 }, { "sum", 8721 }, { "minus", 8722 },
+            { "lowast", 8727 }, { "radic", 8730 }, { "prop", 8733 }, { "infin", 8734 }, { "ang", 8736 },
+            { "and", 8743 }, { "or", 8744 }, { "cap", 8745 }, { "cup", 8746 }, { "int", 8747 }, { "there4", 8756 },
+            { "sim", 8764 }, { "cong", 8773 }, { "asymp", 8776 }, { "ne", 8800 }, { "equiv", 8801 }, { "le", 8804 },
+            { "ge", 8805 }, { "sub", 8834 }, { "sup", 8835 }, { "nsub", 8836 }, { "sube", 8838 }, { "supe", 8839 },
+            { "oplus", 8853 }, { "otimes", 8855 }, { "perp", 8869 }, { "sdot", 8901 }, { "lceil", 8968 },
+            { "rceil", 8969 }, { "lfloor", 8970 }, { "rfloor", 8971 }, { "loz", 9674 }, { "spades", 9824 },
+            { "clubs", 9827 }, { "hearts", 9829 }, { "diams", 9830 }
+        };
+
+        // Longest reference between '&' and ';' that could be valid ("#x10FFFF" is longer than any name).
+        constexpr size_t kMaxReferenceLength = 8;
+
+        constexpr uint32_t HashEntityName(std::string_view const & name) noexcept
+        {
+            auto hash = uint32_t{ 2166136261u };
+            for (auto const ch : name)
+            {
+                hash ^= static_cast<unsigned char>(ch);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        // Open-addressed table of indices into kEntities, filled at compile time. It is kept at most a quarter full,
+        // so a lookup is usually one probe and one string compare.
+        class EntityTable
+        {
+        public:
+            static constexpr size_t kSize = 2048;
+
+            constexpr EntityTable() : m_slots{}
+            {
+                for (size_t n = 0; n < std::size(kEntities); ++n)
+                {
+                    auto slot = HashEntityName(kEntities[n].name) & (kSize - 1);
+                    while (m_slots[slot]) slot = (slot + 1) & (kSize - 1);
+                    m_slots[slot] = static_cast<uint16_t>(n + 1);
+                }
+            }
+
+            // The entity's code point, or 0.
+            constexpr char32_t Find(std::string_view const & name) const noexcept
+            {
+                for (auto slot = HashEntityName(name) & (kSize - 1); m_slots[slot]; slot = (slot + 1) & (kSize - 1))
+                {
+                    auto const & entity = kEntities[m_slots[slot] - 1];
+                    if (entity.name == name) return entity.codepoint;
+                }
+                return 0;
+            }
+
+        private:
+            std::array<uint16_t, kSize> m_slots; // 1 + index into kEntities, or 0 if empty
+        };
+
+        constexpr auto const kEntityTable = EntityTable{};
+        static_assert(std::size(kEntities) * 4 <= EntityTable::kSize);
+        static_assert(kEntityTable.Find("amp") == U'&' && kEntityTable.Find("diams") == 9830 && !kEntityTable.Find("bogus"));
+
+        // The code point of a numeric reference such as "#233" or "#xE9" (without the '#'), or 0 if it is invalid.
+        char32_t ParseCharacterReference(std::string_view const & digits) noexcept
         {
-            savedPos = pos;
-            savedCol = col;
-            savedLine = line;
-            return;
+            auto const hex = !digits.empty() && (digits[0] == 'x' || digits[0] == 'X');
+            auto const first = digits.data() + (hex ? 1 : 0);
+            auto const last = digits.data() + digits.size();
+            auto value = uint32_t{ 0 };
+            auto const [end, ec] = std::from_chars(first, last, value, hex ? 16 : 10);
+            if (ec != std::errc{} || end != last) return 0;
+            if (value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF)) return 0;
+            return static_cast<char32_t>(value);
+        }
+
+        void AppendUtf8(std::string & out, char32_t const cp)
+        {
+            if (cp < 0x80)
+            {
+                out += static_cast<char>(cp);
+            }
+            else if (cp < 0x800)
+            {
+                out += static_cast<char>(0xC0 | (cp >> 6));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                out += static_cast<char>(0xE0 | (cp >> 12));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                out += static_cast<char>(0xF0 | (cp >> 18));
+                out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
         }
-        pos = savedPos;
-        col = savedCol;
-        line = savedLine;
-        c = source[pos];
+    }
+
+    JamlParser::JamlParser(std::string_view const & source, JamlHandler & handler) : source(source), handler(handler), lines(source)
+    {
+        size = source.size();
+        c = size ? source[0] : 0;
+    }
+
+    void JamlParser::ParseFile(std::filesystem::path const & path, JamlHandler & handler)
+    {
+        auto const file = mxi::MappedFile{ path };
+        if (file.empty()) MX_THROW(std::format("Could not open {}", path.string()));
+        JamlParser{ file.data(), handler }.Parse();
     }
 
     [[noreturn]] void JamlParser::Error(std::string_view const & msg) const
     {
+        auto const [line, col] = lines.Locate(pos);
         MX_THROW(std::format("JAML parse error at {},{}: {}", line, col, msg));
     }
 
@@ -53,21 +221,15 @@ namespace Caelus
         Error(std::format("Expected '{}'", expected));
     }
 
-    void JamlParser::Eat(std::string_view const & expected)
+    void JamlParser::Advance(size_t const n)
     {
-        auto end = pos + expected.size();
-        if (end < size)
-        {
-            auto const peek = std::string_view{
-                source.begin() + pos, source.begin() + end
-            };
-            if (peek == expected)
-            {
-                pos = end;
-                return;
-            }
-        }
-        Error(std::format("Expected \"{}\"", expected));
+        pos = (std::min)(pos + n, size);
+        c = (pos >= size) ? 0 : source[pos];
+    }
+
+    bool JamlParser::LookAhead(std::string_view const & expected) const
+    {
+        return source.substr((std::min)(pos + 1, size)).starts_with(expected);
     }
 
     void JamlParser::EatWhitespace()
@@ -88,71 +250,75 @@ namespace Caelus
         }
     }
 
-    bool JamlParser::LookAhead(std::string_view const & expected, bool eatIfFound)
+    void JamlParser::EatComment()
     {
-        auto const start = pos + 1;
-        auto const end = start + expected.size();
-        if (end >= size) return false;
-        auto look = std::string_view{
-            source.begin() + start, source.begin() + end
-        };
-        if (look != expected) return false;
-        if (eatIfFound) Eat(expected);
-        return true;
+        auto const end = source.find("-->", pos + 4);
+        if (end == std::string_view::npos) Error("Unterminated comment.");
+        Advance(end + 3 - pos);
     }
 
     void JamlParser::EatCommentsAndWhitespace()
     {
-        for(;;)
+        for (;;)
         {
             EatWhitespace();
-            if (c != '<') return;
-            if (!LookAhead("!--")) return;
-            auto const sub = source.substr(pos + 3);
-            auto n = sub.find("-->");
-            if (n == std::string::npos) Error("Unterminated comment.");
-            n += 3;
-            while (pos != n) NextChar();
+            if (c != '<' || !LookAhead("!--")) return;
+            EatComment();
         }
     }
 
-    char JamlParser::NextChar()
+    void JamlParser::EatProlog()
     {
-        if (c == '\n')
-        {
-            ++line;
-            col = 0;
-        }
-        else
+        for (;;)
         {
-            ++col;
+            EatCommentsAndWhitespace();
+            if (c != '<') return;
+            if (LookAhead("?"))
+            {
+                // e.g. <?xml version="1.0"?>
+                auto const end = source.find("?>", pos + 2);
+                if (end == std::string_view::npos) Error("Unterminated processing instruction.");
+                Advance(end + 2 - pos);
+                continue;
+            }
+            if (!LookAhead("!")) return;
+            Advance(2);
+            auto const keyword = ParseName();
+            if (!std::ranges::equal(keyword, std::string_view{ "doctype" }, {}, [](char const ch) { return static_cast<char>(std::tolower(static_cast<unsigned char>(ch))); }))
+            {
+                Error("Unsupported declaration.");
+            }
+            EatWhitespace();
+            auto const start = pos;
+            while (c && c != '>') NextChar();
+            Expect('>');
+            handler.Doctype(mxi::trim(source.substr(start, pos - start)));
+            NextChar();
         }
+    }
+
+    char JamlParser::NextChar()
+    {
         ++pos;
         c = (pos >= size) ? 0 : source[pos];
         return c;
     }
 
-    JamlParser::JamlParser(std::string_view const & source, CaelusWindow & window) : source(source), e(window)
+    void JamlParser::Parse()
     {
-        size = source.size();
         if (!size) Error("Empty document");
-        c = source[0];
-        EatCommentsAndWhitespace();
-        ParseTag();
-        if (e.m_tagname == "!doctype")
+        EatProlog();
+        ParseStartTag();
+        while (!open.empty())
         {
-            if (e.m_attributes.size() != 1 ||
-                !e.m_attributes.contains("jaml") ||
-                e.m_attributes["jaml"] != "")
-            {
-                Error("Unsupported doctype");
-            }
-            EatCommentsAndWhitespace();
-            ParseTag();
-            if (e.m_tagname != "jaml") Error("Outermost element should be \"jaml\"");
+            ParseText();
+            if (!c) Error(std::format("Unterminated element \"{}\".", open.back()));
+            if (LookAhead("!--")) EatComment();
+            else if (LookAhead("/")) ParseEndTag();
+            else ParseStartTag();
         }
         EatCommentsAndWhitespace();
-        Expect(0);
+        if (c) Error("Unexpected content after the outermost element.");
     }
 
     std::string_view JamlParser::ParseName()
@@ -170,200 +336,190 @@ namespace Caelus
             case '=':
             case '/':
             case '>':
-                return { source.begin() + start, source.begin() + pos };
+                return source.substr(start, pos - start);
             }
         }
     }
 
-    std::string_view JamlParser::ParseKey()
-    {
-        return ParseName();
-    }
-
     std::string_view JamlParser::ParseValue()
     {
         EatWhitespace();
         if (c != '=') return {};
         NextChar();
         EatWhitespace();
-        auto quoted = c == '"';
-        if (quoted) NextChar();
-        auto const start = pos;
-        for (;; NextChar())
+        auto const quote = c;
+        if (quote == '"' || quote == '\'')
         {
-            if (!quoted)
+            NextChar();
+            auto const start = pos;
+            while (c != quote)
             {
-                switch (c)
-                {
-                case 0:
-                case ' ':
-                case '\t':
-                case '\r':
-                case '\n':
-                case '/':
-                case '>':
-                    break;
-                default:
-                    continue;
-                }
-                break;
+                if (!c) Error("Unterminated string.");
+                NextChar();
             }
-
+            auto const value = source.substr(start, pos - start);
+            NextChar();
+            return value;
+        }
+        auto const start = pos;
+        for (;; NextChar())
+        {
             switch (c)
             {
             case 0:
+            case ' ':
+            case '\t':
             case '\r':
             case '\n':
-                Error("Unterminated string.");
-            case '"':
-                break;
+            case '/':
+            case '>':
+                return source.substr(start, pos - start);
             }
-            break;
         }
-        return { source.begin() + start, source.begin() + pos };
     }
 
     void JamlParser::ParseAttributes()
     {
-        while (c)
+        attributes.clear();
+        for (;;)
         {
             EatWhitespace();
             switch (c)
             {
             case 0:
+                Error("Unterminated tag.");
             case '/':
             case '>':
                 return;
             }
-
-            e.m_attributes[unescape(ParseKey())] = unescape(ParseValue());
+            auto const name = ParseName();
+            if (name.empty()) Error("Expected an attribute name.");
+            attributes.push_back({ name, ParseValue() });
         }
     }
 
-    void JamlParser::ParseTag()
+    void JamlParser::ParseStartTag()
     {
         Expect('<');
         NextChar();
-        EatWhitespace();
-        e.m_tagname = unescape(ParseName());
-        if (e.m_tagname.empty()) Error("Expected an element name.");
+        auto const name = ParseName();
+        if (name.empty()) Error("Expected an element name.");
         ParseAttributes();
-        if (c == '/')
-        {
-            NextChar();
-            Expect('>');
-            return;
-        }
-        Eat(">");
-        if (IsVoidElement(e.m_tagname)) return;
-        ParseContent();
-        Eat(std::format("/{}>", e.m_tagname));
+        auto const selfClosing = c == '/';
+        if (selfClosing) NextChar();
+        Expect('>');
+        NextChar();
+        handler.StartElement(name, attributes);
+        if (selfClosing || IsVoidElement(name)) handler.EndElement(name);
+        else open.push_back(name);
     }
 
-    void JamlParser::ParseContent()
+    void JamlParser::ParseEndTag()
     {
-        RememberPos(true);
-        for(auto start = 0; ; NextChar())
+        Advance(2);
+        auto const name = ParseName();
+        EatWhitespace();
+        Expect('>');
+        if (name != open.back()) Error(std::format("Expected </{}>", open.back()));
+        NextChar();
+        open.pop_back();
+        handler.EndElement(name);
+    }
+
+    void JamlParser::ParseText()
+    {
+        auto const start = pos;
+        auto const end = source.find('<', pos);
+        Advance(((end == std::string_view::npos) ? size : end) - pos);
+        if (pos != start) handler.Text(source.substr(start, pos - start));
+    }
+
+    JamlDomBuilder::JamlDomBuilder(CaelusWindow & window) : window(window) {}
+
+    void JamlDomBuilder::Doctype(std::string_view const & doctype)
+    {
+        if (doctype != "jaml") MX_THROW(std::format("Unsupported doctype \"{}\"", doctype));
+        this->doctype = true;
+    }
+
+    void JamlDomBuilder::StartElement(std::string_view const & name, std::span<Attribute const> const attributes)
+    {
+        static auto const kJaml = mxi::intern("jaml");
+        static auto const kId = mxi::intern("id");
+        static auto const kClass = mxi::intern("class");
+
+        auto const element = e ? window.m_arena.Create() : &window;
+        element->m_tagname = Intern(name); // before linking, so that it is not taken for a text node
+        if (e) e->LinkChild(element);
+        if (!e && doctype && element->m_tagname != kJaml) MX_THROW("Outermost element should be \"jaml\"");
+        for (auto const & attribute : attributes)
         {
-            if (c == '<')
-            {
-                if (start)
-                {
-                    auto text = CaelusElement{};
-                    text.m_text = unescape(mxi::trim(source.substr(start, pos - start)));
-                    e.m_children.push_back(text);
-                }
-                if (LookAhead(std::format("/{}>", e.m_tagname), true)) return;
-                if (LookAhead("/")) Error("Unexpected closing tag.");
-                e = {};
-                ParseTag();
-                e.m_parent->m_children.push_back(e);
-                e = *e.m_parent;
-                continue;
-            }
-            if (!start) start = pos;
+            auto const atom = Intern(attribute.name);
+            auto const value = Unescape(attribute.value);
+            if (atom == kId) element->m_id = mxi::intern(value);
+            else if (atom == kClass) element->SetClasses(value);
+            element->m_attributes.Borrow(atom, value);
         }
-        RememberPos(false);
-        Error("Unterminated element.");
+        window.IndexElement(*element);
+        e = element;
+    }
+
+    void JamlDomBuilder::Text(std::string_view const & text)
+    {
+        auto const trimmed = mxi::trim(text);
+        if (trimmed.empty()) return;
+        auto const node = window.m_arena.Create();
+        node->m_text = Unescape(trimmed);
+        e->LinkChild(node);
+    }
+
+    void JamlDomBuilder::EndElement(std::string_view const &)
+    {
+        e = e->m_parent;
+    }
+
+    std::string_view JamlDomBuilder::Unescape(std::string_view const & raw)
+    {
+        // Most text has no entity references, so can stay a view into the window's source
+        if (raw.find('&') == std::string_view::npos) return raw;
+        return window.m_unescaped.emplace_back(unescape(raw));
+    }
+
+    mxi::Atom JamlDomBuilder::Intern(std::string_view const & raw) const
+    {
+        if (raw.find('&') == std::string_view::npos) return mxi::intern(raw);
+        return mxi::intern(unescape(raw));
     }
 
     std::string unescape(std::string_view const & s)
     {
-        static auto const escs = std::unordered_map<char const *, wchar_t const>
-        {
-            {"amp", L'&'}, {"lt", L'<'}, {"gt", L'>'}, {"quot", L'"'}, {"apos", L'\''}, {"Tab", L'\t'}, {"NewLine", L'\n'}, {"tab", L'\t'}, {"newline", L'\n'}, {"nbsp", 32},
-            {"iexcl", 161}, {"cent", 162}, {"pound", 163}, {"curren", 164}, {"yen", 165}, {"brvbar", 166}, {"sect", 167}, {"uml", 168}, {"copy", 169}, {"ordf", 170}, {"laquo", 171}, {"not", 172}, {"shy", 173}, {"reg", 174}, {"macr", 175}, {"deg", 176},
-            {"plusmn", 177}, {"sup2", 178}, {"sup3", 179}, {"acute", 180}, {"micro", 181}, {"para", 182}, {"dot", 182}, {"cedil", 184}, {"sup1", 185}, {"ordm", 186}, {"raquo", 187}, {"frac14", 188}, {"frac12", 189}, {"frac34", 190}, {"iquest", 191}, {"Agrave", 192},
-            {"Aacute", 193}, {"Acirc", 194}, {"Atilde", 195}, {"Auml", 196}, {"Aring", 197}, {"AElig", 198}, {"Ccedil", 199}, {"Egrave", 200}, {"Eacute", 201}, {"Ecirc", 202}, {"Euml", 203}, {"Igrave", 204}, {"Iacute", 205}, {"Icirc", 206}, {"Iuml", 207}, {"ETH", 208},
-            {"Ntilde", 209}, {"Ograve", 210}, {"Oacute", 211}, {"Ocirc", 212}, {"Otilde", 213}, {"Ouml", 214}, {"times", 215}, {"Oslash", 216}, {"Ugrave", 217}, {"Uacute", 218}, {"Ucirc", 219}, {"Uuml", 220}, {"Yacute", 221}, {"THORN", 222}, {"szlig", 223}, {"agrave", 224},
-            {"aacute", 225}, {"acirc", 226}, {"atilde", 227}, {"auml", 228}, {"aring", 229}, {"aelig", 230}, {"ccedil", 231}, {"egrave", 232}, {"eacute", 233}, {"ecirc", 234}, {"euml", 235}, {"igrave", 236}, {"iacute", 237}, {"icirc", 238}, {"iuml", 239}, {"eth", 240},
-            {"ntilde", 241}, {"ograve", 242}, {"oacute", 243}, {"ocirc", 244}, {"otilde", 245}, {"ouml", 246}, {"divide", 247}, {"oslash", 248}, {"ugrave", 249}, {"uacute", 250}, {"ucirc", 251}, {"uuml", 252}, {"yacute", 253}, {"thorn", 254}, {"yuml", 255}, {"Amacr", 256},
-            {"amacr", 257}, {"Abreve", 258}, {"abreve", 259}, {"Aogon", 260}, {"aogon", 261}, {"Cacute", 262}, {"cacute", 263}, {"Ccirc", 264}, {"ccirc", 265}, {"Cdot", 266}, {"cdot", 267}, {"Ccaron", 268}, {"ccaron", 269}, {"Dcaron", 270}, {"dcaron", 271}, {"Dstrok", 272},
-            {"dstrok", 273}, {"Emacr", 274}, {"emacr", 275}, {"Ebreve", 276}, {"ebreve", 277}, {"Edot", 278}, {"edot", 279}, {"Eogon", 280}, {"eogon", 281}, {"Ecaron", 282}, {"ecaron", 283}, {"Gcirc", 284}, {"gcirc", 285}, {"Gbreve", 286}, {"gbreve", 287}, {"Gdot", 288},
-            {"gdot", 289}, {"Gcedil", 290}, {"gcedil", 291}, {"Hcirc", 292}, {"hcirc", 293}, {"Hstrok", 294}, {"hstrok", 295}, {"Itilde", 296}, {"itilde", 297}, {"Imacr", 298}, {"imacr", 299}, {"Ibreve", 300}, {"ibreve", 301}, {"Iogon", 302}, {"iogon", 303}, {"Idot", 304},
-            {"inodot", 305}, {"IJlig", 306}, {"ijlig", 307}, {"Jcirc", 308}, {"jcirc", 309}, {"Kcedil", 310}, {"kcedil", 311}, {"kgreen", 312}, {"Lacute", 313}, {"lacute", 314}, {"Lcedil", 315}, {"lcedil", 316}, {"Lcaron", 317}, {"lcaron", 318}, {"Lmidot", 319}, {"lmidot", 320},
-            {"Lstrok", 321}, {"lstrok", 322}, {"Nacute", 323}, {"nacute", 324}, {"Ncedil", 325}, {"ncedil", 326}, {"Ncaron", 327}, {"ncaron", 328}, {"napos", 329}, {"ENG", 330}, {"eng", 331}, {"Omacr", 332}, {"omacr", 333}, {"Obreve", 334}, {"obreve", 335}, {"Odblac", 336},
-            {"odblac", 337}, {"OElig", 338}, {"oelig", 339}, {"Racute", 340}, {"racute", 341}, {"Rcedil", 342}, {"rcedil", 343}, {"Rcaron", 344}, {"rcaron", 345}, {"Sacute", 346}, {"sacute", 347}, {"Scirc", 348}, {"scirc", 349}, {"Scedil", 350}, {"scedil", 351}, {"Scaron", 352},
-            {"scaron", 353}, {"Tcedil", 354}, {"tcedil", 355}, {"Tcaron", 356}, {"tcaron", 357}, {"Tstrok", 358}, {"tstrok", 359}, {"Utilde", 360}, {"utilde", 361}, {"Umacr", 362}, {"umacr", 363}, {"Ubreve", 364}, {"ubreve", 365}, {"Uring", 366}, {"uring", 367}, {"Udblac", 368},
-            {"udblac", 369}, {"Uogon", 370}, {"uogon", 371}, {"Wcirc", 372}, {"wcirc", 373}, {"Ycirc", 374}, {"ycirc", 375}, {"Yuml", 376}, {"fnof", 402}, {"circ", 710}, {"tilde", 732}, {"Alpha", 913}, {"Beta", 914}, {"Gamma", 915}, {"Delta", 916}, {"Epsilon", 917},
-            {"Zeta", 918}, {"Eta", 919}, {"Theta", 920}, {"Iota", 921}, {"Kappa", 922}, {"Lambda", 923}, {"Mu", 924}, {"Nu", 925}, {"Xi", 926}, {"Omicron", 927}, {"Pi", 928}, {"Rho", 929}, {"Sigma", 931}, {"Tau", 932}, {"Upsilon", 933}, {"Phi", 934},
-            {"Chi", 935}, {"Psi", 936}, {"Omega", 937}, {"alpha", 945}, {"beta", 946}, {"gamma", 947}, {"delta", 948}, {"epsilon", 949}, {"zeta", 950}, {"eta", 951}, {"theta", 952}, {"iota", 953}, {"kappa", 954}, {"lambda", 955}, {"mu", 956}, {"nu", 957},
-            {"xi", 958}, {"omicron", 959}, {"pi", 960}, {"rho", 961}, {"sigmaf", 962}, {"sigma", 963}, {"tau", 964}, {"upsilon", 965}, {"phi", 966}, {"chi", 967}, {"psi", 968}, {"omega", 969}, {"thetasym", 977}, {"upsih", 978}, {"piv", 982}, {"ensp", 8194},
-            {"emsp", 8195}, {"thinsp", 8201}, {"zwnj", 8204}, {"zwj", 8205}, {"lrm", 8206}, {"rlm", 8207}, {"ndash", 8211}, {"mdash", 8212}, {"lsquo", 8216}, {"rsquo", 8217}, {"sbquo", 8218}, {"ldquo", 8220}, {"rdquo", 8221}, {"bdquo", 8222}, {"dagger", 8224}, {"Dagger", 8225},
-            {"bull", 8226}, {"hellip", 8230}, {"permil", 8240}, {"prime", 8242}, {"Prime", 8243}, {"lsaquo", 8249}, {"rsaquo", 8250}, {"oline", 8254}, {"euro", 8364}, {"trade", 8482}, {"larr", 8592}, {"uarr", 8593}, {"rarr", 8594}, {"darr", 8595}, {"harr", 8596}, {"crarr", 8629},
-            {"forall", 8704}, {"part", 8706}, {"exist", 8707}, {"empty", 8709}, {"nabla", 8711}, {"isin", 8712}, {"notin", 8713}, {"ni", 8715}, {"prod", 8719}, {"sum", 8721}, {"minus", 8722}, {"lowast", 8727}, {"radic", 8730}, {"prop", 8733}, {"infin", 8734}, {"ang", 8736},
-            {"and", 8743}, {"or", 8744}, {"cap", 8745}, {"cup", 8746}, {"int", 8747}, {"there4", 8756}, {"sim", 8764}, {"cong", 8773}, {"asymp", 8776}, {"ne", 8800}, {"equiv", 8801}, {"le", 8804}, {"ge", 8805}, {"sub", 8834}, {"sup", 8835}, {"nsub", 8836},
-            {"sube", 8838}, {"supe", 8839}, {"oplus", 8853}, {"otimes", 8855}, {"perp", 8869}, {"sdot", 8901}, {"lceil", 8968}, {"rceil", 8969}, {"lfloor", 8970}, {"rfloor", 8971}, {"loz", 9674}, {"spades", 9824}, {"clubs", 9827}, {"hearts", 9829}, {"diams", 9830}
-        };
-        auto oss = std::ostringstream{};
+        // A reference is never shorter than its UTF-8 encoding, so the output never outgrows the input
+        auto out = std::string{};
+        out.reserve(s.size());
         size_t pos = 0;
-        size_t amp = 0;
-        while ((amp = s.find_first_of('&', pos)) != std::string::npos)
+        while (auto const found = static_cast<char const *>(std::memchr(s.data() + pos, '&', s.size() - pos)))
         {
-            oss << s.substr(pos, amp - pos);
-            ++amp;
-            auto const sem = s.find_first_of(';', amp);
-            if (sem - amp > 10)
-            {
-                MX_LOG_WARN(std::format("Unterminated HTML escape sequence: {}...", s.substr(0, 8)));
-                oss << s[pos];
-                ++pos;
-                continue;
-            }
-            auto const esc = s.substr(amp, sem - amp);
-            wchar_t w = 0;
-            if (esc.size() && esc[0] == '#')
-            {
-                // TODO validate digits
-                if (esc.size() >= 2 && (esc[1] == 'x' || esc[1] == 'X'))
-                {
-                    unsigned int x;
-                    std::stringstream ss;
-                    ss << std::hex << esc.substr(2);
-                    ss >> x;
-                    w = x;
-                }
-                else
-                {
-                    auto const sub = std::string{esc.substr(1)};
-                    w = atoi(sub.c_str());
-                }
-            }
-            else
+            auto const amp = static_cast<size_t>(found - s.data());
+            out.append(s.data() + pos, amp - pos);
+            auto const sem = s.substr(amp + 1, kMaxReferenceLength + 1).find(';');
+            auto codepoint = char32_t{ 0 };
+            if (sem != std::string_view::npos)
             {
-                auto const sub = std::string{ esc.substr(1) };
-                if (escs.contains(sub.c_str())) w = escs.at(sub.c_str());
+                auto const ref = s.substr(amp + 1, sem);
+                codepoint = (!ref.empty() && ref[0] == '#') ? ParseCharacterReference(ref.substr(1)) : kEntityTable.Find(ref);
             }
-            if (!w)
+            if (!codepoint)
             {
-                MX_LOG_WARN(std::format("Unrecognized HTML escape sequence: {}", esc));
-                oss << s[pos];
-                ++pos;
+                MX_LOG_WARN(std::format("Unrecognized HTML escape sequence: {}", s.substr(amp, kMaxReferenceLength + 2)));
+                out += '&';
+                pos = amp + 1;
                 continue;
             }
-            oss << mxi::Utf8String(std::wstring{w});
-            pos = sem + 1;
+            AppendUtf8(out, codepoint);
+            pos = amp + sem + 2;
         }
+        out.append(s.data() + pos, s.size() - pos);
+        return out;
     }
 
     /*
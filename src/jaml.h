@@ -1,40 +1,101 @@
 #pragma once
 
 #include <filesystem>
+#include <span>
+#include <string>
 #include <string_view>
+#include <vector>
+
+#include "MxiAtom.h"
+#include "MxiUtils.h"
+
 #include "CaelusWindow.h"
 
 namespace Caelus
 {
+    class CaelusElement;
+    class CaelusWindow;
+
+    // Receives a document from JamlParser as a stream of events. Names, values and text are views into the parsed
+    // source and are still escaped (see unescape); the attribute span is only valid for the duration of the call.
+    // Views outlive the call only as long as the source does, which for ParseFile is until it returns.
+    class JamlHandler
+    {
+    public:
+        class Attribute
+        {
+        public:
+            std::string_view name;
+            std::string_view value;
+        };
 
+        virtual ~JamlHandler() = default;
+        virtual void Doctype(std::string_view const & /*doctype*/) {}
+        virtual void StartElement(std::string_view const & name, std::span<Attribute const> const attributes) = 0;
+        virtual void Text(std::string_view const & text) = 0; // raw, including whitespace between tags
+        virtual void EndElement(std::string_view const & name) = 0;
+    };
+
+    // Event-driven tokenizer for JAML and similar XML-ish documents. Apart from the source it keeps only the names
+    // of the open elements, so even a large mapped file parses in memory proportional to its nesting depth.
     class JamlParser
     {
     public:
-        JamlParser(std::string_view const & source, CaelusWindow & window);
+        JamlParser(std::string_view const & source, JamlHandler & handler);
+
+        // Parse the whole document, raising events on the handler as it goes.
+        void Parse();
+
+        // Memory-map the file and parse it. The mapping stays alive for the whole parse and is released on return,
+        // so the handler must copy anything it keeps; JamlDomBuilder does not, and needs a source the window owns.
+        static void ParseFile(std::filesystem::path const & path, JamlHandler & handler);
 
     private:
-        std::string_view const & source;
-        CaelusElement & e;
+        std::string_view source; // borrowed; must outlive the parser (and, for JamlDomBuilder, the window)
+        JamlHandler & handler;
+        std::vector<std::string_view> open = {}; // names of the elements not yet closed, outermost first
+        std::vector<JamlHandler::Attribute> attributes = {}; // of the tag being parsed; reused
         char c = 0;
         size_t size;
         size_t pos = 0;
-        size_t col = 0;
-        size_t line = 0;
+        mxi::LineIndex lines; // for error messages; only pos is tracked while scanning
 
         [[noreturn]] void Error(std::string_view const & msg) const;
         void Expect(char const expected) const;
-        void Eat(std::string_view const & expected);
-        void RememberPos(bool const stash = true);
-        bool LookAhead(std::string_view const & expected, bool const eatIfFound = false);
+        void Advance(size_t const n);
+        bool LookAhead(std::string_view const & expected) const;
         void EatWhitespace();
+        void EatComment();
         void EatCommentsAndWhitespace();
+        void EatProlog();
         char NextChar();
         std::string_view ParseName();
-        std::string_view ParseKey();
         std::string_view ParseValue();
         void ParseAttributes();
-        void ParseContent();
-        void ParseTag();
+        void ParseStartTag();
+        void ParseEndTag();
+        void ParseText();
+    };
+
+    // Builds a window's element tree from parser events. The outermost element is the window itself; the rest are
+    // created in its arena, viewing text and attribute values in the window's retained source.
+    class JamlDomBuilder : public JamlHandler
+    {
+    public:
+        explicit JamlDomBuilder(CaelusWindow & window);
+
+        void Doctype(std::string_view const & doctype) override;
+        void StartElement(std::string_view const & name, std::span<Attribute const> const attributes) override;
+        void Text(std::string_view const & text) override;
+        void EndElement(std::string_view const & name) override;
+
+    private:
+        std::string_view Unescape(std::string_view const & raw);
+        mxi::Atom Intern(std::string_view const & raw) const;
+
+        CaelusWindow & window;
+        CaelusElement * e = nullptr; // innermost open element
+        bool doctype = false;
     };
 
     // Unescape HTML text (e.g. &amp; to &)
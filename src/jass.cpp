@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <format>
 
 #include "MxiLogging.h"
@@ -7,8 +8,8 @@
 
 namespace jass
 {
-    Property::Property(std::string_view const & prop, std::string_view const & value, size_t line, size_t col)
-        : m_prop(std::string{ prop }), m_line(line), m_col(col)
+    Property::Property(std::string_view const & value, size_t line, size_t col)
+        : m_line(static_cast<uint32_t>(line)), m_col(static_cast<uint32_t>(col))
     {
         static constexpr auto const kImportant = "!important";
         static constexpr auto const cch = std::char_traits<char>::length(kImportant);
@@ -23,26 +24,543 @@ namespace jass
         }
     };
 
-    void JassParser::RememberPos(bool const stash)
+    Property const & Declarations::Get(PropertyId const id) const
     {
-        static size_t savedPos = 0;
-        static size_t savedCol = 0;
-        static size_t savedLine = 0;
-        if (stash)
+        if (!Has(id)) MX_THROW(std::format("Property \"{}\" is not declared", GetPropertyName(id)));
+        return m_values[Rank(id)];
+    }
+
+    void Declarations::Set(PropertyId const id, Property && property)
+    {
+        auto const bit = PropertyBit(id);
+        if (property.m_important) m_importantMask |= bit;
+        else m_importantMask &= ~bit;
+
+        if (m_mask & bit)
+        {
+            m_values[Rank(id)] = std::move(property);
+            return;
+        }
+        m_values.insert(m_values.begin() + Rank(id), std::move(property));
+        m_mask |= bit;
+    }
+
+    void Declarations::Parse(PropertyId const id, Property && property)
+    {
+        auto const setLonghand = [&](PropertyId const longhand, std::string_view const & value)
+        {
+            auto expanded = property;
+            expanded.m_value = value;
+            expanded.m_typed = ParsePropertyValue(longhand, expanded.m_value);
+            Set(longhand, std::move(expanded));
+        };
+        auto const setEdges = [&](PropertyId const top, PropertyId const right, PropertyId const bottom, PropertyId const left)
+        {
+            auto const values = EdgeValues::Split(property.m_value);
+            setLonghand(top, values.top);
+            setLonghand(right, values.right);
+            setLonghand(bottom, values.bottom);
+            setLonghand(left, values.left);
+        };
+        auto const setBorder = [&](PropertyId const width, PropertyId const color)
         {
-            savedPos = pos;
-            savedCol = col;
-            savedLine = line;
+            auto const border = Border::Parse(property.m_value);
+            auto expanded = property;
+            expanded.m_typed = border.width;
+            Set(width, Property{ expanded });
+            expanded.m_typed = border.color;
+            Set(color, std::move(expanded));
+        };
+
+        switch (id)
+        {
+        case PropertyId::BORDER:
+            setBorder(PropertyId::BORDER_TOP_WIDTH, PropertyId::BORDER_TOP_COLOR);
+            setBorder(PropertyId::BORDER_RIGHT_WIDTH, PropertyId::BORDER_RIGHT_COLOR);
+            setBorder(PropertyId::BORDER_BOTTOM_WIDTH, PropertyId::BORDER_BOTTOM_COLOR);
+            setBorder(PropertyId::BORDER_LEFT_WIDTH, PropertyId::BORDER_LEFT_COLOR);
+            return;
+        case PropertyId::BORDER_TOP: setBorder(PropertyId::BORDER_TOP_WIDTH, PropertyId::BORDER_TOP_COLOR); return;
+        case PropertyId::BORDER_RIGHT: setBorder(PropertyId::BORDER_RIGHT_WIDTH, PropertyId::BORDER_RIGHT_COLOR); return;
+        case PropertyId::BORDER_BOTTOM: setBorder(PropertyId::BORDER_BOTTOM_WIDTH, PropertyId::BORDER_BOTTOM_COLOR); return;
+        case PropertyId::BORDER_LEFT: setBorder(PropertyId::BORDER_LEFT_WIDTH, PropertyId::BORDER_LEFT_COLOR); return;
+        case PropertyId::BORDER_COLOR:
+            setEdges(PropertyId::BORDER_TOP_COLOR, PropertyId::BORDER_RIGHT_COLOR, PropertyId::BORDER_BOTTOM_COLOR, PropertyId::BORDER_LEFT_COLOR);
+            return;
+        case PropertyId::BORDER_WIDTH:
+            setEdges(PropertyId::BORDER_TOP_WIDTH, PropertyId::BORDER_RIGHT_WIDTH, PropertyId::BORDER_BOTTOM_WIDTH, PropertyId::BORDER_LEFT_WIDTH);
+            return;
+        case PropertyId::MARGIN:
+            setEdges(PropertyId::MARGIN_TOP, PropertyId::MARGIN_RIGHT, PropertyId::MARGIN_BOTTOM, PropertyId::MARGIN_LEFT);
+            return;
+        case PropertyId::PADDING:
+            setEdges(PropertyId::PADDING_TOP, PropertyId::PADDING_RIGHT, PropertyId::PADDING_BOTTOM, PropertyId::PADDING_LEFT);
             return;
         }
-        pos = savedPos;
-        col = savedCol;
-        line = savedLine;
-        c = source[pos];
+        property.m_typed = ParsePropertyValue(id, property.m_value);
+        Set(id, std::move(property));
+    }
+
+    namespace
+    {
+        // The whitespace-separated parts of a declaration value. Whitespace inside parentheses does not separate, so
+        // "2px rgb(0, 0, 0)" has two parts.
+        std::vector<std::string_view> SplitValue(std::string_view const & value)
+        {
+            auto parts = std::vector<std::string_view>{};
+            auto depth = 0;
+            auto start = std::string_view::npos;
+            for (size_t i = 0; i <= value.size(); ++i)
+            {
+                auto const c = (i < value.size()) ? value[i] : ' ';
+                if (c == '(') ++depth;
+                else if (c == ')') --depth;
+                auto const isSpace = (c == ' ' || c == '\t' || c == '\r' || c == '\n') && depth <= 0;
+                if (!isSpace && start == std::string_view::npos) start = i;
+                if (!isSpace || start == std::string_view::npos) continue;
+                parts.push_back(value.substr(start, i - start));
+                start = std::string_view::npos;
+            }
+            return parts;
+        }
+    }
+
+    EdgeValues EdgeValues::Split(std::string_view const & value)
+    {
+        auto const values = SplitValue(value);
+        if (values.empty()) MX_THROW("Expected 1 to 4 values, got none");
+        if (values.size() > 4) MX_THROW(std::format("Expected 1 to 4 values, got \"{}\"", value));
+
+        auto const count = values.size();
+        auto const right = (count > 1) ? values[1] : values[0];
+        return { values[0], right, (count > 2) ? values[2] : values[0], (count > 3) ? values[3] : right };
+    }
+
+    Border Border::Parse(std::string_view const & border)
+    {
+        auto result = Border{};
+        for (auto const tok : SplitValue(border))
+        {
+            if (tok == "solid") continue; // the only border style
+            if (auto const width = Caelus::Measure::TryParse(tok)) result.width = *width;
+            else if (auto const color = Caelus::Color::TryParse(tok)) result.color = *color;
+            else MX_THROW(std::format("Unidentified border format token: {}", tok));
+        }
+        return result;
+    }
+
+    bool IsShorthand(PropertyId const id)
+    {
+        switch (id)
+        {
+        case PropertyId::BORDER:
+        case PropertyId::BORDER_BOTTOM:
+        case PropertyId::BORDER_COLOR:
+        case PropertyId::BORDER_LEFT:
+        case PropertyId::BORDER_RIGHT:
+        case PropertyId::BORDER_TOP:
+        case PropertyId::BORDER_WIDTH:
+        case PropertyId::MARGIN:
+        case PropertyId::PADDING:
+            return true;
+        }
+        return false;
+    }
+
+    PropertyValue ParsePropertyValue(PropertyId const id, std::string_view const & value)
+    {
+        using namespace Caelus;
+        if (IsShorthand(id)) MX_THROW(std::format("\"{}\" is a shorthand and has no value of its own", GetPropertyName(id)));
+        switch (id)
+        {
+        case PropertyId::BACKGROUND_COLOR:
+        case PropertyId::BORDER_BOTTOM_COLOR:
+        case PropertyId::BORDER_LEFT_COLOR:
+        case PropertyId::BORDER_RIGHT_COLOR:
+        case PropertyId::BORDER_TOP_COLOR:
+        case PropertyId::COLOR:
+            return Color::Parse(value);
+
+        case PropertyId::BOTTOM: return Tether::Parse(Edge::BOTTOM, value);
+        case PropertyId::LEFT: return Tether::Parse(Edge::LEFT, value);
+        case PropertyId::RIGHT: return Tether::Parse(Edge::RIGHT, value);
+        case PropertyId::TOP: return Tether::Parse(Edge::TOP, value);
+
+        case PropertyId::FONT_FACE:
+        case PropertyId::POSITION:
+            return std::string{ value };
+
+        case PropertyId::HEIGHT:
+        case PropertyId::MARGIN_BOTTOM:
+        case PropertyId::MARGIN_LEFT:
+        case PropertyId::MARGIN_RIGHT:
+        case PropertyId::MARGIN_TOP:
+        case PropertyId::MAX_WIDTH:
+        case PropertyId::MIN_WIDTH:
+        case PropertyId::WIDTH:
+            if (value == "auto") return Auto{};
+            return Measure::Parse(value);
+
+        default:
+            return Measure::Parse(value);
+        }
+    }
+
+    uint32_t AncestorFilter::Hash(SimpleSelectorType const kind, mxi::Atom const atom)
+    {
+        // Salt by kind so that e.g. tag "row" and class "row" don't collide, then mix
+        auto h = (atom * 0x9E3779B1u) ^ (static_cast<uint32_t>(kind) * 0x85EBCA77u);
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        return h ? h : 1;
+    }
+
+    AncestorFilter::Hashes AncestorFilter::GetAncestorHashes(std::vector<Selector> const & complex)
+    {
+        auto hashes = Hashes{};
+        size_t n = 0;
+        auto const add = [&](SimpleSelectorType const kind, mxi::Atom const atom)
+        {
+            if (atom && n < kMaxHashes) hashes[n++] = Hash(kind, atom);
+        };
+
+        // A compound is on the ancestor chain when the compound to its right is a child or descendant of it.
+        // Compounds reached through a sibling combinator are siblings of an ancestor, so are skipped.
+        for (auto i = complex.size(); i-- > 1;)
+        {
+            auto const combinator = complex[i].combinator;
+            if (combinator != Combinator::CHILD && combinator != Combinator::DESCENDANT) continue;
+            auto const & ancestor = complex[i - 1];
+            add(SimpleSelectorType::ID, ancestor.id);
+            for (auto const c : ancestor.classes) add(SimpleSelectorType::CLASS, c);
+            add(SimpleSelectorType::TYPE, ancestor.type);
+        }
+        return hashes;
+    }
+
+    void AncestorFilter::Add(uint32_t const hash)
+    {
+        auto & a = m_counters[hash & kMask];
+        auto & b = m_counters[(hash >> kBits) & kMask];
+        if (a != 0xFF) ++a;
+        if (b != 0xFF) ++b;
+    }
+
+    void AncestorFilter::Remove(uint32_t const hash)
+    {
+        // Saturated counters stay put; they can only cause false positives
+        auto & a = m_counters[hash & kMask];
+        auto & b = m_counters[(hash >> kBits) & kMask];
+        if (a != 0xFF) --a;
+        if (b != 0xFF) --b;
+    }
+
+    bool AncestorFilter::MightContain(uint32_t const hash) const
+    {
+        return m_counters[hash & kMask] && m_counters[(hash >> kBits) & kMask];
+    }
+
+    void AncestorFilter::PushElement(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes)
+    {
+        if (type) Add(Hash(SimpleSelectorType::TYPE, type));
+        if (id) Add(Hash(SimpleSelectorType::ID, id));
+        for (auto const c : classes) Add(Hash(SimpleSelectorType::CLASS, c));
+    }
+
+    void AncestorFilter::PopElement(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes)
+    {
+        if (type) Remove(Hash(SimpleSelectorType::TYPE, type));
+        if (id) Remove(Hash(SimpleSelectorType::ID, id));
+        for (auto const c : classes) Remove(Hash(SimpleSelectorType::CLASS, c));
+    }
+
+    bool AncestorFilter::FastReject(Hashes const & hashes)
+    {
+        ++m_tests;
+        for (auto const hash : hashes)
+        {
+            if (!hash) break;
+            if (!MightContain(hash))
+            {
+                ++m_rejects;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RuleIndex::Clear()
+    {
+        m_byId.clear();
+        m_byClass.clear();
+        m_byAttribute.clear();
+        m_byType.clear();
+        m_universal.clear();
+        m_positional = false;
+    }
+
+    void RuleIndex::Build(std::vector<Rule> const & rules)
+    {
+        Clear();
+        for (size_t order = 0; order < rules.size(); ++order)
+        {
+            auto const & rule = rules[order];
+            for (size_t n = 0; n < rule.selectors.size(); ++n)
+            {
+                auto const & complex = rule.selectors[n].compounds;
+                auto const & subject = complex.back();
+                auto const entry = Entry{ &rule, n, order, AncestorFilter::GetAncestorHashes(complex) };
+                for (auto const & compound : complex)
+                {
+                    if (compound.combinator == Combinator::NEXT_SIBLING || compound.combinator == Combinator::SUBSEQUENT_SIBLING || !compound.pseudoclasses.empty())
+                    {
+                        m_positional = true;
+                    }
+                }
+                if (subject.id) m_byId[subject.id].push_back(entry);
+                else if (!subject.classes.empty()) m_byClass[subject.classes.front()].push_back(entry);
+                else if (!subject.attributeMatchers.empty()) m_byAttribute[subject.attributeMatchers.front().name].push_back(entry);
+                else if (subject.type) m_byType[subject.type].push_back(entry);
+                else m_universal.push_back(entry);
+            }
+        }
+    }
+
+    ComplexSelector::ComplexSelector(uint64_t const specificity, std::vector<Selector> && compounds)
+        : specificity(specificity), compounds(std::move(compounds))
+    {
+        auto const & complex = this->compounds;
+        if (complex.empty()) MX_THROW("Empty complex selector.");
+        if (complex.size() > kMaxCompounds) MX_THROW(std::format("Complex selectors are limited to {} compound selectors.", kMaxCompounds));
+        for (auto & compound : this->compounds)
+        {
+            compound.attributeMatchers.clear();
+            for (auto const & attribute : compound.attributes) compound.attributeMatchers.push_back(AttributeSelector::Parse(attribute));
+            compound.positions.clear();
+            for (auto const & pseudoClass : compound.pseudoclasses) compound.positions.push_back(ChildPosition::Parse(pseudoClass));
+        }
+
+        program.reserve(complex.size() * 2);
+        for (auto i = complex.size(); i-- > 0;)
+        {
+            program.push_back({ SelectorOp::MATCH, static_cast<uint16_t>(i) });
+            if (i == 0) break;
+            switch (complex[i].combinator)
+            {
+            case Combinator::CHILD: program.push_back({ SelectorOp::PARENT, 0 }); break;
+            case Combinator::DESCENDANT: program.push_back({ SelectorOp::ANCESTOR, 0 }); break;
+            case Combinator::NEXT_SIBLING: program.push_back({ SelectorOp::PREV_SIBLING, 0 }); break;
+            case Combinator::SUBSEQUENT_SIBLING: program.push_back({ SelectorOp::ANY_PREV_SIBLING, 0 }); break;
+            default: MX_THROW("Column combinators are not supported.");
+            }
+        }
+        program.push_back({ SelectorOp::DONE, 0 });
+    }
+
+    AttributeSelector AttributeSelector::Parse(std::string_view const & text)
+    {
+        auto selector = AttributeSelector{};
+        auto const op = text.find_first_of("=~^$|*");
+        selector.name = mxi::intern(mxi::trim(text.substr(0, op)));
+        if (!selector.name) MX_THROW(std::format("Missing attribute name in \"[{}]\"", text));
+        if (op == std::string_view::npos) return selector;
+
+        auto rest = text.substr(op);
+        if (rest.starts_with("=")) selector.match = Match::EQUALS;
+        else if (rest.starts_with("~=")) selector.match = Match::INCLUDES;
+        else if (rest.starts_with("^=")) selector.match = Match::PREFIX;
+        else if (rest.starts_with("$=")) selector.match = Match::SUFFIX;
+        else MX_THROW(std::format("Unsupported attribute selector \"[{}]\"", text));
+        rest.remove_prefix(selector.match == Match::EQUALS ? 1 : 2);
+
+        auto value = mxi::trim(rest);
+        if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+        {
+            value = value.substr(1, value.size() - 2);
+        }
+        selector.value = value;
+        selector.hash = mxi::hash_bytes(selector.value);
+        return selector;
+    }
+
+    bool AttributeSelector::Matches(std::string_view const & attribute, uint64_t const attributeHash) const noexcept
+    {
+        switch (match)
+        {
+        case Match::EXISTS:
+            return true;
+        case Match::EQUALS:
+            // The hashes differ for almost every non-match, so the string compare only confirms a hit
+            return attributeHash == hash && attribute == value;
+        case Match::INCLUDES:
+            if (value.empty() || value.find_first_of(" \t\r\n") != std::string::npos) return false;
+            for (size_t start = 0; start < attribute.size();)
+            {
+                auto const end = (std::min)(attribute.find_first_of(" \t\r\n", start), attribute.size());
+                if (attribute.substr(start, end - start) == value) return true;
+                start = end + 1;
+            }
+            return false;
+        case Match::PREFIX:
+            return !value.empty() && attribute.starts_with(value);
+        case Match::SUFFIX:
+            return !value.empty() && attribute.ends_with(value);
+        }
+        return false;
+    }
+
+    ChildPosition ChildPosition::Parse(std::string_view const & pseudoClass)
+    {
+        if (pseudoClass == "first-child") return {};
+        if (pseudoClass == "last-child") return { 0, 1, true };
+
+        static constexpr auto const kNthChild = std::string_view{ "nth-child(" };
+        if (!pseudoClass.starts_with(kNthChild) || !pseudoClass.ends_with(')'))
+        {
+            MX_THROW(std::format("Unsupported pseudo-class \":{}\"", pseudoClass));
+        }
+        auto const arg = mxi::trim(pseudoClass.substr(kNthChild.size(), pseudoClass.size() - kNthChild.size() - 1));
+        if (arg == "odd") return { 2, 1 };
+        if (arg == "even") return { 2, 0 };
+
+        // [+-][a]n[ [+-] b] or [+-]b
+        auto const error = [&]() { MX_THROW(std::format("Invalid :nth-child argument \"{}\"", arg)); };
+        size_t pos = 0;
+        auto const skipSpace = [&]() { while (pos < arg.size() && arg[pos] == ' ') ++pos; };
+        auto const sign = [&]()
+        {
+            if (pos < arg.size() && (arg[pos] == '+' || arg[pos] == '-')) return (arg[pos++] == '-') ? -1 : 1;
+            return 1;
+        };
+        auto const number = [&]() -> std::optional<int32_t>
+        {
+            if (pos >= arg.size() || arg[pos] < '0' || arg[pos] > '9') return std::nullopt;
+            auto n = int32_t{ 0 };
+            while (pos < arg.size() && arg[pos] >= '0' && arg[pos] <= '9') n = n * 10 + (arg[pos++] - '0');
+            return n;
+        };
+
+        auto position = ChildPosition{};
+        auto const leading = sign();
+        auto const first = number();
+        if (pos < arg.size() && (arg[pos] == 'n' || arg[pos] == 'N'))
+        {
+            ++pos;
+            position.a = leading * first.value_or(1);
+            skipSpace();
+            position.b = 0;
+            if (pos < arg.size())
+            {
+                // Unlike the leading sign, this one is required: "2n 1" is not "2n+1"
+                if (arg[pos] != '+' && arg[pos] != '-') error();
+                auto const trailing = sign();
+                skipSpace();
+                auto const b = number();
+                if (!b) error();
+                position.b = trailing * b.value();
+            }
+        }
+        else
+        {
+            if (!first) error();
+            position.a = 0;
+            position.b = leading * first.value();
+        }
+        if (pos != arg.size()) error();
+        return position;
+    }
+
+    bool ChildPosition::Matches(size_t const index, size_t const count) const noexcept
+    {
+        auto const p = static_cast<int64_t>(fromEnd ? count - index : index + 1);
+        if (a == 0) return p == b;
+        auto const offset = p - b;
+        return offset % a == 0 && offset / a >= 0;
+    }
+
+    void InvalidationSets::Clear()
+    {
+        m_classes.clear();
+        m_ids.clear();
+        m_attributes.clear();
+    }
+
+    void InvalidationSets::Build(std::vector<Rule> const & rules)
+    {
+        Clear();
+        for (auto const & rule : rules)
+        {
+            for (auto const & selector : rule.selectors)
+            {
+                auto const & complex = selector.compounds;
+
+                // Walk right to left, tracking where the subject lies relative to an element matching compound i
+                auto invalidation = uint8_t{ INVALIDATE_SELF };
+                for (auto i = complex.size(); i-- > 0;)
+                {
+                    auto const & compound = complex[i];
+                    if (compound.id) m_ids[compound.id] |= invalidation;
+                    for (auto const c : compound.classes) m_classes[c] |= invalidation;
+                    for (auto const & attribute : compound.attributeMatchers) m_attributes[attribute.name] |= invalidation;
+
+                    switch (compound.combinator)
+                    {
+                    case Combinator::CHILD:
+                    case Combinator::DESCENDANT:
+                        invalidation = INVALIDATE_DESCENDANTS;
+                        break;
+                    case Combinator::NEXT_SIBLING:
+                    case Combinator::SUBSEQUENT_SIBLING:
+                        invalidation = (invalidation == INVALIDATE_SELF || invalidation == INVALIDATE_SIBLINGS) ? INVALIDATE_SIBLINGS : INVALIDATE_SIBLING_DESCENDANTS;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    void InvalidationSets::Merge(InvalidationSets const & other)
+    {
+        for (auto const & [atom, bits] : other.m_classes) m_classes[atom] |= bits;
+        for (auto const & [atom, bits] : other.m_ids) m_ids[atom] |= bits;
+        for (auto const & [atom, bits] : other.m_attributes) m_attributes[atom] |= bits;
+    }
+
+    uint8_t InvalidationSets::Find(std::unordered_map<mxi::Atom, uint8_t> const & map, mxi::Atom const atom)
+    {
+        auto const found = map.find(atom);
+        return (found == map.end()) ? INVALIDATE_NONE : found->second;
+    }
+
+    void RuleIndex::GetCandidates(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes,
+        std::vector<mxi::Atom> const & attributes, std::vector<Entry const *> & out) const
+    {
+        auto const start = out.size();
+        auto const append = [&out](auto const & map, mxi::Atom const key)
+        {
+            auto const found = map.find(key);
+            if (found == map.end()) return;
+            for (auto const & entry : found->second) out.push_back(&entry);
+        };
+
+        if (id) append(m_byId, id);
+        for (auto const c : classes) append(m_byClass, c);
+        for (auto const a : attributes) append(m_byAttribute, a);
+        if (type) append(m_byType, type);
+        for (auto const & entry : m_universal) out.push_back(&entry);
+
+        // Keep the cascade's source-order tie-break intact, and drop repeats caused by duplicate class names
+        std::sort(out.begin() + start, out.end(), [](Entry const * a, Entry const * b)
+        {
+            return (a->order != b->order) ? a->order < b->order : a->selector < b->selector;
+        });
+        out.erase(std::unique(out.begin() + start, out.end()), out.end());
     }
 
     void JassParser::Error(std::string_view const & msg) const
     {
+        auto const [line, col] = lines.Locate(pos);
         MX_THROW(std::format("JASS parse error at {},{}: {}", line, col, msg));
     }
 
@@ -62,7 +580,7 @@ namespace jass
             };
             if (peek == expected)
             {
-                pos = end;
+                while (pos != end) NextChar();
                 return;
             }
         }
@@ -107,31 +625,20 @@ namespace jass
             EatWhitespace();
             if (c != '/') return;
             if (!LookAhead("*")) return;
-            auto const sub = source.substr(pos + 2);
-            auto n = sub.find("*/");
+            auto const n = source.find("*/", pos + 2);
             if (n == std::string::npos) Error("Unterminated comment.");
-            n += 2;
-            while (pos != n) NextChar();
+            while (pos != n + 2) NextChar();
         }
     }
 
     char JassParser::NextChar()
     {
-        if (c == '\n')
-        {
-            ++line;
-            col = 0;
-        }
-        else
-        {
-            ++col;
-        }
         ++pos;
         c = (pos >= size) ? 0 : source[pos];
         return c;
     }
 
-    JassParser::JassParser(std::string_view const & source, std::vector<Rule> & rules) : source(source)
+    JassParser::JassParser(std::string_view const & source, std::vector<Rule> & rules) : source(source), lines(source)
     {
         size = source.size();
         if (!size) Error("Empty document");
@@ -175,23 +682,54 @@ namespace jass
             case '\n':
             case ';':
             case '}':
-                return { source.begin() + start, source.begin() + pos };
+                // Without the whitespace before the terminator, which is not part of the value
+                return mxi::trim({ source.begin() + start, source.begin() + pos });
             }
         }
     }
 
     Rule JassParser::ParseRule()
     {
+        auto const [line, col] = lines.Locate(pos);
         auto rule = Rule{line, col};
 
         auto start = pos;
 
-        auto selector = Selector{nullptr};
+        auto selector = Selector{};
         auto complex = std::vector<Selector>{};
         auto combinator = Combinator::NONE;
-        auto workingType = SimpleSelectorType::TYPE;
+        auto workingType = SimpleSelectorType::NONE;
         auto workingName = std::string{};
+        auto typeName = std::string{};
+        auto idName = std::string{};
         bool done = false;
+
+        // Intern the names gathered for the current compound selector
+        auto const finishCompound = [&]()
+        {
+            selector.type = (typeName == "*") ? mxi::kNullAtom : mxi::intern(typeName);
+            selector.id = mxi::intern(idName);
+            std::sort(selector.classes.begin(), selector.classes.end());
+            typeName.clear();
+            idName.clear();
+        };
+
+        // True until the current compound selector has any part
+        auto const compoundEmpty = [&]()
+        {
+            return typeName.empty() && idName.empty() && workingType == SimpleSelectorType::NONE
+                && selector.classes.empty() && selector.attributes.empty() && selector.pseudoclasses.empty();
+        };
+
+        // Store a class or pseudo-class name once its end is reached
+        auto const finishName = [&]()
+        {
+            if (workingType == SimpleSelectorType::CLASS) selector.classes.push_back(mxi::intern(workingName));
+            else if (workingType == SimpleSelectorType::PSEUDO_CLASS) selector.pseudoclasses.push_back(workingName);
+            workingName = std::string{};
+            workingType = SimpleSelectorType::NONE;
+        };
+
         uint64_t specificity = 0;
         for (auto start = pos; c != 0; NextChar())
         {
@@ -201,24 +739,35 @@ namespace jass
                 Error("Unexpected end of input while parsing selectors.");
             case ',':
             case '{':
-                if (workingType == SimpleSelectorType::ATTRIBUTE) Error("Unterminated attribute selector.");
-                if (workingType == SimpleSelectorType::CLASS)
+                finishName();
+                if (compoundEmpty()) Error(std::format("Expected a selector before '{}'.", c));
+                if (combinator != Combinator::NONE && combinator != Combinator::DESCENDANT) Error("Expected a selector after the combinator.");
+                finishCompound();
+                complex.push_back(selector);
+                if (complex.size() > ComplexSelector::kMaxCompounds)
                 {
-                    selector.classes.push_back(workingName);
-                    workingName = std::string{};
+                    Error(std::format("Complex selectors are limited to {} compound selectors.", ComplexSelector::kMaxCompounds));
                 }
-                complex.push_back(selector);
-                rule.selectors.push_back({ specificity, complex });
+                try
+                {
+                    rule.selectors.emplace_back(specificity, std::move(complex));
+                }
+                catch (std::exception const & e)
+                {
+                    Error(e.what()); // e.g. a malformed attribute selector or :nth-child argument
+                }
+                complex = {};
                 specificity = 0;
-                if (c == ',') selector = Selector{nullptr};
+                selector = Selector{};
                 combinator = Combinator::NONE;
-                done = true;
+                done = (c == '{');
                 break;
             case ' ':
             case '\r':
             case '\n':
             case '\t':
-                if (combinator == Combinator::NONE) combinator = Combinator::DESCENDANT;
+                // Whitespace separates compounds, but not at the start of a selector, e.g. after a ','
+                if (combinator == Combinator::NONE && !compoundEmpty()) combinator = Combinator::DESCENDANT;
                 break;
             case '>':
                 combinator = Combinator::CHILD;
@@ -230,67 +779,82 @@ namespace jass
                 combinator = Combinator::NEXT_SIBLING;
                 break;
             case '|':
-                if (LookAhead("|", true)) Error("Namespace selectors are not supported.");
-                combinator = Combinator::COLUMN;
-                break;
-            case ']':
-                if (workingType != SimpleSelectorType::ATTRIBUTE) Error("Unexpected ']'.");
-                selector.attributes.push_back(workingName);
-                workingName = std::string{};
-                workingType = SimpleSelectorType::NONE;
+                if (LookAhead("|", true)) Error("Column combinators are not supported.");
+                Error("Namespace selectors are not supported.");
+            case '(':
+                // Pseudo-class arguments, e.g. nth-child(2n + 1), are kept verbatim
+                if (workingType != SimpleSelectorType::PSEUDO_CLASS) Error("Unexpected '('.");
+                for (; c != ')'; NextChar())
+                {
+                    if (!c) Error("Unterminated pseudo-class argument.");
+                    workingName.push_back(c);
+                }
+                workingName.push_back(c);
                 continue;
+            case ']':
+                Error("Unexpected ']'.");
             case '#':
             case '.':
             case ':':
             case '[':
                 if (combinator != Combinator::NONE)
                 {
+                    finishCompound();
                     complex.push_back(selector);
-                    selector = Selector{&selector};
+                    selector = Selector{};
                     selector.combinator = combinator;
                     combinator = Combinator::NONE;
                 }
-                if (workingType == SimpleSelectorType::ATTRIBUTE) Error("Unterminated attribute selector.");
-                if (workingType == SimpleSelectorType::CLASS)
-                {
-                    selector.classes.push_back(workingName);
-                    workingName = std::string{};
-                }
+                finishName();
                 switch (c)
                 {
                 case '.': workingType = SimpleSelectorType::CLASS; specificity += 0x000000010000; continue;
                 case '#': workingType = SimpleSelectorType::ID; specificity += 0x000000000001; continue;
                 case ':':
                     if (LookAhead(":", true)) Error("Psuedo-element selectors are not supported.");
-                    else workingType = SimpleSelectorType::PSEUDO_CLASS;
+                    workingType = SimpleSelectorType::PSEUDO_CLASS;
+                    specificity += 0x000000010000;
                     continue;
                 case '[':
-                    workingType = SimpleSelectorType::ATTRIBUTE;
+                    // Attribute selectors are kept verbatim, e.g. data-state = "short", and compiled with the selector
+                    specificity += 0x000000010000;
+                    NextChar();
+                    for (auto quote = char{ 0 }; quote || c != ']'; NextChar())
+                    {
+                        if (!c) Error("Unterminated attribute selector.");
+                        if (c == quote) quote = 0;
+                        else if (!quote && (c == '"' || c == '\'')) quote = c;
+                        workingName.push_back(c);
+                    }
+                    selector.attributes.push_back(workingName);
+                    workingName = std::string{};
                     continue;
                 }
                 continue;
             default:
                 if (combinator != Combinator::NONE)
                 {
+                    finishCompound();
                     complex.push_back(selector);
-                    selector = Selector{&selector};
+                    selector = Selector{};
                     selector.combinator = combinator;
                     combinator = Combinator::NONE;
                 }
                 switch (workingType)
                 {
                 case SimpleSelectorType::NONE:
-                    specificity += 0x000100000000;
+                    if (c != '*') specificity += 0x000100000000;
                     workingType = SimpleSelectorType::TYPE;
                     [[fallthrough]];
                 case SimpleSelectorType::TYPE:
-                    selector.type.push_back(c);
+                    typeName.push_back(c);
                     continue;
                 case SimpleSelectorType::ID:
-                    selector.id.push_back(c);
+                    idName.push_back(c);
                     continue;
                 case SimpleSelectorType::CLASS:
                 case SimpleSelectorType::ATTRIBUTE:
+                case SimpleSelectorType::PSEUDO_CLASS:
                     workingName.push_back(c);
                     continue;
                 }
@@ -299,13 +863,7 @@ namespace jass
             if (done) break;
 
             // Combinator encountered
-            if (workingType == SimpleSelectorType::ATTRIBUTE) Error("Unterminated attribute selector.");
-            if (workingType == SimpleSelectorType::CLASS)
-            {
-                selector.classes.push_back(workingName);
-                workingName = std::string{};
-                workingType == SimpleSelectorType::TYPE;
-            }
+            finishName();
         }
 
         Eat("{");
@@ -317,46 +875,46 @@ namespace jass
             auto p = ValidateProperty(k);
             EatCommentsAndWhitespace();
             auto v = ParseValue();
-            rule.styles[p] = { k, v, line, col };
+            try
+            {
+                auto const [valueLine, valueCol] = lines.Locate(pos);
+                rule.styles.Parse(p, Property{ v, valueLine, valueCol });
+            }
+            catch (std::exception const & e)
+            {
+                Error(std::format("Invalid value for \"{}\": {}", k, e.what()));
+            }
             if (c != '}') NextChar();
             EatCommentsAndWhitespace();
         }
+        Expect('}');
+        NextChar();
         return rule;
     }
 
-    const char * JassParser::ValidateProperty(std::string_view const & k) const
-    {
-        static constexpr auto names = {
-            "background-color",
-            "border",
-            "border-bottom",
-            "border-left",
-            "border-right",
-            "border-top",
-            "bottom",
-            "color",
-            "font-face",
-            "font-size",
-            "height",
-            "left",
-            "max-width",
-            "min-width",
-            "padding",
-            "padding-bottom",
-            "padding-left",
-            "padding-right",
-            "padding-top",
-            "right",
-            "top",
-            "width"
-        };
+    PropertyId JassParser::ValidateProperty(std::string_view const & k) const
+    {
+        auto const id = FindProperty(k);
+        if (!id) Error(std::format("Unknown JASS property \"{}\"", k));
+        return id.value();
+    }
+
+#define JASS_PROPERTY_NAME(K, ID, NAME) K,
+
+    static constexpr char const * kPropertyNames[] = { JASS_PROPERTIES(JASS_PROPERTY_NAME) };
 
-        for (auto const & name : names)
+    std::optional<PropertyId> FindProperty(std::string_view const & k)
+    {
+        for (size_t i = 0; i < kPropertyCount; ++i)
         {
-            if (k == name) return name;
+            if (k == kPropertyNames[i]) return static_cast<PropertyId>(i);
         }
+        return std::nullopt;
+    }
 
-        Error(std::format("Unknown JASS property \"{}\"", k));
+    char const * GetPropertyName(PropertyId const id)
+    {
+        return kPropertyNames[static_cast<size_t>(id)];
     }
     /*
         try
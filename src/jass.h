@@ -1,36 +1,79 @@
 #pragma once
 
+#include <array>
+#include <bit>
 #include <filesystem>
+#include <optional>
 #include <string_view>
 #include <unordered_map>
+#include <variant>
 
+#include "MxiAtom.h"
 #include "MxiUtils.h"
 
+#include "CaelusColor.h"
+#include "CaelusMeasure.h"
+
 namespace jass
 {
-    static constexpr auto const kBorder = "border";
-    static constexpr auto const kBorderBottom = "border-bottom";
-    static constexpr auto const kBorderLeft = "border-left";
-    static constexpr auto const kBorderRight = "border-right";
-    static constexpr auto const kBorderTop = "border-top";
-    static constexpr auto const kBorderWidth = "border-width";
-    static constexpr auto const kBottom = "bottom";
-    static constexpr auto const kHeight = "height";
-    static constexpr auto const kLeft = "left";
-    static constexpr auto const kMargin = "margin";
-    static constexpr auto const kMarginBottom = "margin-bottom";
-    static constexpr auto const kMarginLeft = "margin-left";
-    static constexpr auto const kMarginRight = "margin-right";
-    static constexpr auto const kMarginTop = "margin-top";
-    static constexpr auto const kPadding = "padding";
-    static constexpr auto const kPaddingBottom = "padding-bottom";
-    static constexpr auto const kPaddingLeft = "padding-left";
-    static constexpr auto const kPaddingRight = "padding-right";
-    static constexpr auto const kPaddingTop = "padding-top";
-    static constexpr auto const kPosition = "position";
-    static constexpr auto const kRight = "right";
-    static constexpr auto const kTop = "top";
-    static constexpr auto const kWidth = "width";
+    // Every JASS property: constant name, PropertyId and property name.
+#define JASS_PROPERTIES(X) \
+    X(kBackgroundColor, BACKGROUND_COLOR, "background-color") \
+    X(kBorder, BORDER, "border") \
+    X(kBorderBottom, BORDER_BOTTOM, "border-bottom") \
+    X(kBorderBottomColor, BORDER_BOTTOM_COLOR, "border-bottom-color") \
+    X(kBorderBottomWidth, BORDER_BOTTOM_WIDTH, "border-bottom-width") \
+    X(kBorderColor, BORDER_COLOR, "border-color") \
+    X(kBorderLeft, BORDER_LEFT, "border-left") \
+    X(kBorderLeftColor, BORDER_LEFT_COLOR, "border-left-color") \
+    X(kBorderLeftWidth, BORDER_LEFT_WIDTH, "border-left-width") \
+    X(kBorderRight, BORDER_RIGHT, "border-right") \
+    X(kBorderRightColor, BORDER_RIGHT_COLOR, "border-right-color") \
+    X(kBorderRightWidth, BORDER_RIGHT_WIDTH, "border-right-width") \
+    X(kBorderTop, BORDER_TOP, "border-top") \
+    X(kBorderTopColor, BORDER_TOP_COLOR, "border-top-color") \
+    X(kBorderTopWidth, BORDER_TOP_WIDTH, "border-top-width") \
+    X(kBorderWidth, BORDER_WIDTH, "border-width") \
+    X(kBottom, BOTTOM, "bottom") \
+    X(kColor, COLOR, "color") \
+    X(kFontFace, FONT_FACE, "font-face") \
+    X(kFontSize, FONT_SIZE, "font-size") \
+    X(kHeight, HEIGHT, "height") \
+    X(kLeft, LEFT, "left") \
+    X(kMargin, MARGIN, "margin") \
+    X(kMarginBottom, MARGIN_BOTTOM, "margin-bottom") \
+    X(kMarginLeft, MARGIN_LEFT, "margin-left") \
+    X(kMarginRight, MARGIN_RIGHT, "margin-right") \
+    X(kMarginTop, MARGIN_TOP, "margin-top") \
+    X(kMaxWidth, MAX_WIDTH, "max-width") \
+    X(kMinWidth, MIN_WIDTH, "min-width") \
+    X(kPadding, PADDING, "padding") \
+    X(kPaddingBottom, PADDING_BOTTOM, "padding-bottom") \
+    X(kPaddingLeft, PADDING_LEFT, "padding-left") \
+    X(kPaddingRight, PADDING_RIGHT, "padding-right") \
+    X(kPaddingTop, PADDING_TOP, "padding-top") \
+    X(kPosition, POSITION, "position") \
+    X(kRight, RIGHT, "right") \
+    X(kTop, TOP, "top") \
+    X(kWidth, WIDTH, "width")
+
+#define JASS_PROPERTY_CONSTANT(K, ID, NAME) static constexpr auto const K = NAME;
+#define JASS_PROPERTY_ID(K, ID, NAME) ID,
+
+    JASS_PROPERTIES(JASS_PROPERTY_CONSTANT)
+
+    enum class PropertyId : uint8_t
+    {
+        JASS_PROPERTIES(JASS_PROPERTY_ID)
+        last
+    };
+
+    static constexpr size_t kPropertyCount = static_cast<size_t>(PropertyId::last);
+    static_assert(kPropertyCount <= 64, "PropertyMask holds one bit per property");
+
+    // One bit per PropertyId.
+    using PropertyMask = uint64_t;
+    constexpr PropertyMask PropertyBit(PropertyId const id) { return PropertyMask{ 1 } << static_cast<size_t>(id); }
 
     MX_COLLECTION(Dimension, WIDTH, HEIGHT);};
 
@@ -106,15 +149,92 @@ namespace jass
         }
     }
 
+    // Look up a property by name. Returns std::nullopt if it is not a JASS property.
+    std::optional<PropertyId> FindProperty(std::string_view const & name);
+
+    // The k* constant for a property.
+    char const * GetPropertyName(PropertyId const id);
+
+    // The keyword "auto", as in width: auto.
+    class Auto {};
+
+    // A border shorthand, e.g. "2px gray solid".
+    class Border
+    {
+    public:
+        static Border Parse(std::string_view const & spec);
+        Caelus::Measure width = {};
+        Caelus::Color color = {};
+    };
+
+    // The values of a 1-4 value per-edge shorthand, e.g. padding: 2px 4px. As in CSS they are given as top, right,
+    // bottom, left; a missing right copies top, bottom copies top and left copies right.
+    class EdgeValues
+    {
+    public:
+        // Values are separated by whitespace outside parentheses. Throws unless there are 1 to 4 values.
+        static EdgeValues Split(std::string_view const & value);
+        std::string_view top;
+        std::string_view right;
+        std::string_view bottom;
+        std::string_view left;
+    };
+
+    // A declaration's value in the form its property takes. Shorthands never get this far; see Declarations::Parse.
+    using PropertyValue = std::variant<std::monostate, Auto, Caelus::Color, Caelus::Measure, Caelus::Tether, std::string>;
+
+    // True for border, border-*, border-color, border-width, margin and padding, which expand into longhands.
+    bool IsShorthand(PropertyId const id);
+
+    // Parse a declaration's value for the given longhand property. Throws if it is malformed or a shorthand.
+    PropertyValue ParsePropertyValue(PropertyId const id, std::string_view const & value);
+
     class Property
     {
     public:
-        Property(std::string_view const & prop, std::string_view const & value, size_t line, size_t col);
-        std::string m_prop;
+        // Strips any trailing !important from value into m_important.
+        Property(std::string_view const & value, size_t line, size_t col);
         std::string m_value;
-        bool m_important;
-        size_t m_line;
-        size_t m_col;
+        PropertyValue m_typed = {};
+        bool m_important = false;
+        uint32_t m_line;
+        uint32_t m_col;
+    };
+
+    // A declaration block: a presence mask plus one Property per set bit, stored densely in PropertyId order.
+    class Declarations
+    {
+    public:
+        bool Has(PropertyId const id) const noexcept { return m_mask & PropertyBit(id); }
+        bool IsImportant(PropertyId const id) const noexcept { return m_importantMask & PropertyBit(id); }
+        PropertyMask GetMask() const noexcept { return m_mask; }
+        PropertyMask GetImportantMask() const noexcept { return m_importantMask; }
+        bool empty() const noexcept { return !m_mask; }
+        size_t size() const noexcept { return m_values.size(); }
+
+        Property const & Get(PropertyId const id) const;
+        void Set(PropertyId const id, Property && property);
+
+        // Parse property's value and set it, expanding a shorthand into its per-edge longhands. Throws if the
+        // value is malformed.
+        void Parse(PropertyId const id, Property && property);
+
+        // Call f(id, property) for every declaration in mask, in PropertyId order.
+        template<typename F>
+        void ForEach(PropertyMask const mask, F const & f) const
+        {
+            for (auto m = mask & m_mask; m; m &= m - 1)
+            {
+                auto const id = static_cast<PropertyId>(std::countr_zero(m));
+                f(id, m_values[Rank(id)]);
+            }
+        }
+
+    private:
+        size_t Rank(PropertyId const id) const noexcept { return std::popcount(m_mask & (PropertyBit(id) - 1)); }
+        PropertyMask m_mask = 0;
+        PropertyMask m_importantMask = 0;
+        std::vector<Property> m_values = {};
     };
 
     enum Combinator
@@ -127,46 +247,209 @@ namespace jass
         NONE, TYPE, ID, CLASS, ATTRIBUTE, PSEUDO_CLASS, PSEUDO_ELEMENT
     };
 
+    // A structural pseudo-class: matches children at 1-based positions an+b (n >= 0), counted from the first
+    // child or, for :last-child, from the last.
+    class ChildPosition
+    {
+    public:
+        // Parse first-child, last-child or nth-child(an+b|odd|even). Throws for anything else.
+        static ChildPosition Parse(std::string_view const & pseudoClass);
+        bool Matches(size_t const index, size_t const count) const noexcept;
+        int32_t a = 0;
+        int32_t b = 1;
+        bool fromEnd = false;
+    };
+
+    // A compiled attribute selector: [name], [name=v], [name~=v], [name^=v] or [name$=v].
+    class AttributeSelector
+    {
+    public:
+        enum class Match : uint8_t
+        {
+            EXISTS, EQUALS, INCLUDES, PREFIX, SUFFIX
+        };
+
+        // Parse the text between the brackets. Throws for an unsupported operator.
+        static AttributeSelector Parse(std::string_view const & text);
+
+        // Test an element's value for the attribute; attributeHash is mxi::hash_bytes(attribute).
+        bool Matches(std::string_view const & attribute, uint64_t const attributeHash) const noexcept;
+
+        mxi::Atom name = mxi::kNullAtom;
+        Match match = Match::EXISTS;
+        std::string value = {}; // unquoted
+        uint64_t hash = 0; // mxi::hash_bytes(value)
+    };
+
     class Selector
     {
     public:
-        std::string type = {};
-        std::string id = {};
-        std::vector<std::string> classes = {};
+        mxi::Atom type = mxi::kNullAtom; // kNullAtom for universal
+        mxi::Atom id = mxi::kNullAtom;
+        std::vector<mxi::Atom> classes = {}; // sorted
         std::vector<std::string> attributes = {};
+        std::vector<AttributeSelector> attributeMatchers = {}; // compiled from attributes
         std::vector<std::string> pseudoclasses = {};
+        std::vector<ChildPosition> positions = {}; // compiled from pseudoclasses
         Combinator combinator = Combinator::NONE; // relation to parent (left) CompoundSelector
-        Selector const * parent = nullptr;
-        Selector(Selector const * parent) : parent(parent) {};
+    };
+
+    // One step of a compiled complex selector. Programs run right to left, starting at the subject element.
+    enum class SelectorOp : uint8_t
+    {
+        MATCH, // the current element must match compounds[compound]
+        PARENT, // step to the parent
+        ANCESTOR, // step to some ancestor, nearest first
+        PREV_SIBLING, // step to the previous sibling
+        ANY_PREV_SIBLING, // step to some earlier sibling, nearest first
+        DONE // matched
+    };
+
+    class SelectorInstruction
+    {
+    public:
+        SelectorOp op;
+        uint16_t compound;
+    };
+
+    class ComplexSelector
+    {
+    public:
+        static constexpr size_t kMaxCompounds = 32;
+
+        // Compiles compounds into program, and their attributes and pseudo-classes into attributeMatchers and
+        // positions. Throws for an empty selector, too many compounds, a column combinator or an unsupported
+        // attribute operator or pseudo-class.
+        ComplexSelector(uint64_t const specificity, std::vector<Selector> && compounds);
+
+        uint64_t specificity;
+        std::vector<Selector> compounds; // left to right
+        std::vector<SelectorInstruction> program; // right to left
     };
 
     class Rule
     {
     public:
         Rule(size_t line, size_t col) : m_line(line), m_col(col) {}
-        std::vector<std::pair<uint64_t, std::vector<Selector>>> selectors = {};
-        std::unordered_map<char const *, Property> styles = {};
+        std::vector<ComplexSelector> selectors = {};
+        Declarations styles = {};
         size_t m_line;
         size_t m_col;
     };
 
+    // Counting Bloom filter of the type, id and class atoms of the elements on the current ancestor
+    // chain. Maintained during a top-down style traversal so that a rule whose ancestor compounds
+    // need atoms that are definitely absent can be rejected without walking up the tree.
+    class AncestorFilter
+    {
+    public:
+        static constexpr size_t kMaxHashes = 4;
+        using Hashes = std::array<uint32_t, kMaxHashes>; // zero-terminated
+
+        static uint32_t Hash(SimpleSelectorType const kind, mxi::Atom const atom);
+
+        // Collect the hashes of atoms required on ancestors of the subject of a complex selector.
+        static Hashes GetAncestorHashes(std::vector<Selector> const & complex);
+
+        void PushElement(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes);
+        void PopElement(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes);
+
+        // True if at least one required hash is definitely not on the ancestor chain.
+        bool FastReject(Hashes const & hashes);
+
+        size_t m_tests = 0;
+        size_t m_rejects = 0;
+
+    private:
+        static constexpr size_t kBits = 12;
+        static constexpr uint32_t kMask = (1 << kBits) - 1;
+        void Add(uint32_t const hash);
+        void Remove(uint32_t const hash);
+        bool MightContain(uint32_t const hash) const;
+        std::array<uint8_t, 1 << kBits> m_counters = {};
+    };
+
+    // Buckets rules by the id, first class, first attribute name or type of the rightmost compound selector
+    // (in that order of preference) so that an element only tests rules which could possibly match it.
+    class RuleIndex
+    {
+    public:
+        class Entry
+        {
+        public:
+            Rule const * rule;
+            size_t selector; // index into rule->selectors
+            size_t order; // source order of the rule
+            AncestorFilter::Hashes ancestorHashes;
+        };
+
+        void Build(std::vector<Rule> const & rules);
+        void Clear();
+
+        // Appends candidate entries for an element to out, in source order.
+        void GetCandidates(mxi::Atom const type, mxi::Atom const id, std::vector<mxi::Atom> const & classes,
+            std::vector<mxi::Atom> const & attributes, std::vector<Entry const *> & out) const;
+
+        // True if any selector depends on an element's siblings or position, so equal siblings may style differently.
+        bool HasPositionalRules() const noexcept { return m_positional; }
+
+    private:
+        bool m_positional = false;
+        std::unordered_map<mxi::Atom, std::vector<Entry>> m_byId = {};
+        std::unordered_map<mxi::Atom, std::vector<Entry>> m_byClass = {};
+        std::unordered_map<mxi::Atom, std::vector<Entry>> m_byAttribute = {};
+        std::unordered_map<mxi::Atom, std::vector<Entry>> m_byType = {};
+        std::vector<Entry> m_universal = {};
+    };
+
+    // Which elements a change to one element's classes, id or attributes can restyle.
+    enum Invalidation : uint8_t
+    {
+        INVALIDATE_NONE = 0,
+        INVALIDATE_SELF = 1, // named in a subject compound
+        INVALIDATE_DESCENDANTS = 2, // named in a compound matched against an ancestor
+        INVALIDATE_SIBLINGS = 4, // named in a compound matched against an earlier sibling
+        INVALIDATE_SIBLING_DESCENDANTS = 8 // named in a compound matched against an earlier sibling of an ancestor
+    };
+
+    // For each class, id and attribute name in a stylesheet, the Invalidation bits of every position it is used in.
+    class InvalidationSets
+    {
+    public:
+        void Build(std::vector<Rule> const & rules);
+        void Clear();
+
+        // Add the bits of another stylesheet's sets.
+        void Merge(InvalidationSets const & other);
+
+        uint8_t ForClass(mxi::Atom const atom) const { return Find(m_classes, atom); }
+        uint8_t ForId(mxi::Atom const atom) const { return Find(m_ids, atom); }
+        uint8_t ForAttribute(mxi::Atom const atom) const { return Find(m_attributes, atom); }
+
+    private:
+        static uint8_t Find(std::unordered_map<mxi::Atom, uint8_t> const & map, mxi::Atom const atom);
+        std::unordered_map<mxi::Atom, uint8_t> m_classes = {};
+        std::unordered_map<mxi::Atom, uint8_t> m_ids = {};
+        std::unordered_map<mxi::Atom, uint8_t> m_attributes = {};
+    };
+
+    // Appends the rules parsed from source. All parse state lives in the instance, so separate sheets can be
+    // parsed concurrently (see StyleSheet::LoadAll).
     class JassParser
     {
     public:
         JassParser(std::string_view const & source, std::vector<Rule> & rules);
 
     private:
-        std::string_view const & source;
+        std::string_view source; // borrowed for the duration of the constructor; rules copy what they keep
         char c = 0;
         size_t size;
         size_t pos = 0;
-        size_t col = 0;
-        size_t line = 0;
+        mxi::LineIndex lines; // for diagnostics; only pos is tracked while scanning
 
         [[noreturn]] void Error(std::string_view const & msg) const;
         void Expect(char const expected) const;
         void Eat(std::string_view const & expected);
-        void RememberPos(bool const stash = true);
         bool LookAhead(std::string_view const & expected, bool const eatIfFound = false);
         void EatWhitespace();
         void EatCommentsAndWhitespace();
@@ -175,7 +458,7 @@ namespace jass
         std::vector<std::string> ParseSelectors();
         std::string_view ParseKey();
         std::string_view ParseValue();
-        const char * ValidateProperty(std::string_view const & k) const;
+        PropertyId ValidateProperty(std::string_view const & k) const;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,628 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "MxiAtom.h"
+#include "MxiLogging.h"
+#include "MxiUtils.h"
+
+#include "jassc.h"
+
+namespace jass
+{
+    namespace
+    {
+        constexpr uint32_t kMagic = 0x4353534A; // "JSSC"
+        constexpr uint32_t kVersion = 3;
+        constexpr uint32_t kNone = 0xFFFFFFFF;
+
+        // On-disk records. Sections follow the header in this order: complexes, strings, lists, rules,
+        // compounds, declarations, then the string bytes. The header and complexes are 8-byte records,
+        // everything after them is 4-byte, so every section is naturally aligned in a mapped view.
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t sourceHash;
+            uint32_t complexCount;
+            uint32_t stringCount;
+            uint32_t listCount;
+            uint32_t ruleCount;
+            uint32_t compoundCount;
+            uint32_t declarationCount;
+            uint32_t charCount;
+            uint32_t reserved;
+        };
+
+        struct ComplexRecord
+        {
+            uint64_t specificity;
+            uint32_t firstCompound;
+            uint32_t compoundCount;
+        };
+
+        struct StringRecord
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct RuleRecord
+        {
+            uint32_t line;
+            uint32_t col;
+            uint32_t firstComplex;
+            uint32_t complexCount;
+            uint32_t firstDeclaration;
+            uint32_t declarationCount;
+        };
+
+        struct CompoundRecord
+        {
+            uint32_t type; // string index or kNone
+            uint32_t id; // string index or kNone
+            uint32_t combinator;
+            uint32_t firstClass; // into lists
+            uint32_t classCount;
+            uint32_t firstAttribute;
+            uint32_t attributeCount;
+            uint32_t firstPseudoClass;
+            uint32_t pseudoClassCount;
+        };
+
+        struct DeclarationRecord
+        {
+            uint32_t prop; // string index
+            uint32_t value; // string index
+            uint32_t line;
+            uint32_t col;
+            uint32_t important;
+            uint32_t kind; // PropertyValue alternative
+            uint32_t text; // string index (string value or tether id) or kNone
+            uint32_t edge; // tether edge
+            uint32_t unit; // measure unit
+            uint32_t numberLo; // measure value, as the bits of a double
+            uint32_t numberHi;
+            uint32_t argb; // color
+        };
+
+        class Writer
+        {
+        public:
+            uint32_t String(std::string_view const & s)
+            {
+                auto const found = m_stringIndex.find(std::string{ s });
+                if (found != m_stringIndex.end()) return found->second;
+                auto const n = static_cast<uint32_t>(m_strings.size());
+                m_strings.push_back({ static_cast<uint32_t>(m_chars.size()), static_cast<uint32_t>(s.size()) });
+                m_chars.append(s);
+                m_stringIndex.emplace(s, n);
+                return n;
+            }
+
+            uint32_t Atom(mxi::Atom const atom)
+            {
+                return atom ? String(mxi::atom_name(atom)) : kNone;
+            }
+
+            template<typename V, typename F>
+            uint32_t List(V const & values, F const & toString)
+            {
+                auto const first = static_cast<uint32_t>(m_lists.size());
+                for (auto const & v : values) m_lists.push_back(toString(v));
+                return first;
+            }
+
+            std::vector<ComplexRecord> m_complexes = {};
+            std::vector<StringRecord> m_strings = {};
+            std::vector<uint32_t> m_lists = {};
+            std::vector<RuleRecord> m_rules = {};
+            std::vector<CompoundRecord> m_compounds = {};
+            std::vector<DeclarationRecord> m_declarations = {};
+            std::string m_chars = {};
+
+        private:
+            std::unordered_map<std::string, uint32_t> m_stringIndex = {};
+        };
+
+        void EncodeValue(Writer & w, PropertyValue const & value, DeclarationRecord & record)
+        {
+            record.kind = static_cast<uint32_t>(value.index());
+            record.text = kNone;
+            auto const measure = [&record](Caelus::Measure const & m)
+            {
+                auto const bits = std::bit_cast<uint64_t>(m.value);
+                record.numberLo = static_cast<uint32_t>(bits);
+                record.numberHi = static_cast<uint32_t>(bits >> 32);
+                record.unit = static_cast<uint32_t>(m.unit);
+            };
+
+            if (auto const color = std::get_if<Caelus::Color>(&value)) record.argb = color->argb();
+            else if (auto const m = std::get_if<Caelus::Measure>(&value)) measure(*m);
+            else if (auto const tether = std::get_if<Caelus::Tether>(&value))
+            {
+                measure(tether->offset);
+                record.text = w.String(tether->id);
+                record.edge = static_cast<uint32_t>(static_cast<Edge::Value>(tether->edge));
+            }
+            else if (auto const text = std::get_if<std::string>(&value)) record.text = w.String(*text);
+        }
+
+        // Returns false if the record does not hold a valid value.
+        template<typename S>
+        bool DecodeValue(DeclarationRecord const & record, S const & string, PropertyValue & value)
+        {
+            if (record.unit > Caelus::Unit::PC) return false;
+            auto const bits = (static_cast<uint64_t>(record.numberHi) << 32) | record.numberLo;
+            auto const measure = Caelus::Measure{ std::bit_cast<double>(bits), static_cast<Caelus::Unit>(record.unit) };
+            auto color = Caelus::Color{};
+            color.argb(record.argb);
+
+            switch (record.kind)
+            {
+            case 0: value = std::monostate{}; return true;
+            case 1: value = Auto{}; return true;
+            case 2: value = color; return true;
+            case 3: value = measure; return true;
+            case 4:
+            {
+                if (record.text == kNone) return false;
+                switch (static_cast<Edge::Value>(record.edge))
+                {
+                case Edge::Value::TOP: value = Caelus::Tether{ string(record.text), Edge::TOP, measure }; return true;
+                case Edge::Value::LEFT: value = Caelus::Tether{ string(record.text), Edge::LEFT, measure }; return true;
+                case Edge::Value::BOTTOM: value = Caelus::Tether{ string(record.text), Edge::BOTTOM, measure }; return true;
+                case Edge::Value::RIGHT: value = Caelus::Tether{ string(record.text), Edge::RIGHT, measure }; return true;
+                }
+                return false;
+            }
+            case 5:
+                if (record.text == kNone) return false;
+                value = std::string{ string(record.text) };
+                return true;
+            }
+            return false;
+        }
+
+        class Reader
+        {
+        public:
+            Reader(std::string_view const & data) : m_data(data) {}
+
+            template<typename T>
+            T const * Section(size_t const count)
+            {
+                if (!m_ok || count > (m_data.size() - m_pos) / sizeof(T)) { m_ok = false; return nullptr; }
+                auto const p = reinterpret_cast<T const *>(m_data.data() + m_pos);
+                m_pos += count * sizeof(T);
+                return p;
+            }
+
+            bool m_ok = true;
+
+        private:
+            std::string_view m_data;
+            size_t m_pos = 0;
+        };
+    }
+
+    std::filesystem::path GetCompiledPath(std::filesystem::path const & source, size_t const n)
+    {
+        auto path = source;
+        path += (n == -1ULL) ? std::string{ ".jassc" } : std::format(".{}.jassc", n);
+        return path;
+    }
+
+    std::string SerializeRules(uint64_t const sourceHash, std::vector<Rule> const & rules, size_t const first)
+    {
+        auto w = Writer{};
+        for (auto r = first; r < rules.size(); ++r)
+        {
+            auto const & rule = rules[r];
+            auto record = RuleRecord{};
+            record.line = static_cast<uint32_t>(rule.m_line);
+            record.col = static_cast<uint32_t>(rule.m_col);
+            record.firstComplex = static_cast<uint32_t>(w.m_complexes.size());
+            record.complexCount = static_cast<uint32_t>(rule.selectors.size());
+            for (auto const & complex : rule.selectors)
+            {
+                w.m_complexes.push_back({ complex.specificity, static_cast<uint32_t>(w.m_compounds.size()), static_cast<uint32_t>(complex.compounds.size()) });
+                for (auto const & selector : complex.compounds)
+                {
+                    auto compound = CompoundRecord{};
+                    compound.type = w.Atom(selector.type);
+                    compound.id = w.Atom(selector.id);
+                    compound.combinator = static_cast<uint32_t>(selector.combinator);
+                    compound.firstClass = w.List(selector.classes, [&](mxi::Atom const a) { return w.Atom(a); });
+                    compound.classCount = static_cast<uint32_t>(selector.classes.size());
+                    compound.firstAttribute = w.List(selector.attributes, [&](std::string const & s) { return w.String(s); });
+                    compound.attributeCount = static_cast<uint32_t>(selector.attributes.size());
+                    compound.firstPseudoClass = w.List(selector.pseudoclasses, [&](std::string const & s) { return w.String(s); });
+                    compound.pseudoClassCount = static_cast<uint32_t>(selector.pseudoclasses.size());
+                    w.m_compounds.push_back(compound);
+                }
+            }
+            record.firstDeclaration = static_cast<uint32_t>(w.m_declarations.size());
+            record.declarationCount = static_cast<uint32_t>(rule.styles.size());
+            rule.styles.ForEach(~PropertyMask{}, [&](PropertyId const prop, Property const & property)
+            {
+                auto decl = DeclarationRecord{};
+                decl.prop = w.String(GetPropertyName(prop));
+                decl.value = w.String(property.m_value);
+                decl.line = property.m_line;
+                decl.col = property.m_col;
+                decl.important = property.m_important ? 1u : 0u;
+                EncodeValue(w, property.m_typed, decl);
+                w.m_declarations.push_back(decl);
+            });
+            w.m_rules.push_back(record);
+        }
+
+        auto header = FileHeader{};
+        header.magic = kMagic;
+        header.version = kVersion;
+        header.sourceHash = sourceHash;
+        header.complexCount = static_cast<uint32_t>(w.m_complexes.size());
+        header.stringCount = static_cast<uint32_t>(w.m_strings.size());
+        header.listCount = static_cast<uint32_t>(w.m_lists.size());
+        header.ruleCount = static_cast<uint32_t>(w.m_rules.size());
+        header.compoundCount = static_cast<uint32_t>(w.m_compounds.size());
+        header.declarationCount = static_cast<uint32_t>(w.m_declarations.size());
+        header.charCount = static_cast<uint32_t>(w.m_chars.size());
+
+        auto out = std::string{};
+        auto const write = [&out](auto const & v)
+        {
+            out.append(reinterpret_cast<char const *>(v.data()), v.size() * sizeof(v[0]));
+        };
+        out.append(reinterpret_cast<char const *>(&header), sizeof(header));
+        write(w.m_complexes);
+        write(w.m_strings);
+        write(w.m_lists);
+        write(w.m_rules);
+        write(w.m_compounds);
+        write(w.m_declarations);
+        write(w.m_chars);
+        return out;
+    }
+
+    void WriteCompiled(std::filesystem::path const & path, uint64_t const sourceHash, std::vector<Rule> const & rules, size_t const first)
+    {
+        auto const data = SerializeRules(sourceHash, rules, first);
+
+        // Written aside and renamed into place, so a reader (or another thread compiling the same sheet) never sees
+        // a partial file
+        auto temp = path;
+        temp += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            auto out = std::ofstream{ temp, std::ios::binary | std::ios::trunc };
+            if (!out) MX_THROW(std::format("Unable to write compiled stylesheet: {}", temp.string()));
+            out.write(data.data(), data.size());
+            if (!out) MX_THROW(std::format("Unable to write compiled stylesheet: {}", temp.string()));
+        }
+        auto error = std::error_code{};
+        std::filesystem::rename(temp, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temp, error);
+            MX_THROW(std::format("Unable to replace compiled stylesheet: {}", path.string()));
+        }
+    }
+
+    bool ReadCompiled(std::filesystem::path const & path, uint64_t const sourceHash, std::vector<Rule> & rules)
+    {
+        if (!std::filesystem::exists(path)) return false;
+        auto const file = mxi::MappedFile{ path };
+        if (file.empty()) return false;
+        return DeserializeRules(file.data(), sourceHash, rules);
+    }
+
+    bool DeserializeRules(std::string_view const & data, uint64_t const sourceHash, std::vector<Rule> & rules)
+    {
+        auto reader = Reader{ data };
+        auto const header = reader.Section<FileHeader>(1);
+        if (!header || header->magic != kMagic || header->version != kVersion || header->sourceHash != sourceHash) return false;
+
+        auto const complexes = reader.Section<ComplexRecord>(header->complexCount);
+        auto const strings = reader.Section<StringRecord>(header->stringCount);
+        auto const lists = reader.Section<uint32_t>(header->listCount);
+        auto const ruleRecords = reader.Section<RuleRecord>(header->ruleCount);
+        auto const compounds = reader.Section<CompoundRecord>(header->compoundCount);
+        auto const declarations = reader.Section<DeclarationRecord>(header->declarationCount);
+        auto const chars = reader.Section<char>(header->charCount);
+        if (!reader.m_ok) return false;
+
+        auto ok = true;
+        auto const string = [&](uint32_t const n) -> std::string_view
+        {
+            if (n >= header->stringCount) { ok = false; return {}; }
+            auto const & s = strings[n];
+            if (s.offset > header->charCount || s.length > header->charCount - s.offset) { ok = false; return {}; }
+            return { chars + s.offset, s.length };
+        };
+        auto const atom = [&](uint32_t const n) { return (n == kNone) ? mxi::kNullAtom : mxi::intern(string(n)); };
+        auto const inRange = [](uint32_t const first, uint32_t const count, uint32_t const size) { return first <= size && count <= size - first; };
+
+        auto loaded = std::vector<Rule>{};
+        loaded.reserve(header->ruleCount);
+        for (uint32_t r = 0; r < header->ruleCount && ok; ++r)
+        {
+            auto const & record = ruleRecords[r];
+            if (!inRange(record.firstComplex, record.complexCount, header->complexCount)) return false;
+            if (!inRange(record.firstDeclaration, record.declarationCount, header->declarationCount)) return false;
+
+            auto rule = Rule{ record.line, record.col };
+            for (auto x = record.firstComplex; x < record.firstComplex + record.complexCount; ++x)
+            {
+                auto const & cx = complexes[x];
+                if (!inRange(cx.firstCompound, cx.compoundCount, header->compoundCount)) return false;
+                if (cx.compoundCount == 0 || cx.compoundCount > ComplexSelector::kMaxCompounds) return false;
+                auto complex = std::vector<Selector>{};
+                for (auto n = cx.firstCompound; n < cx.firstCompound + cx.compoundCount; ++n)
+                {
+                    auto const & cp = compounds[n];
+                    if (!inRange(cp.firstClass, cp.classCount, header->listCount)) return false;
+                    if (!inRange(cp.firstAttribute, cp.attributeCount, header->listCount)) return false;
+                    if (!inRange(cp.firstPseudoClass, cp.pseudoClassCount, header->listCount)) return false;
+                    if (cp.combinator >= Combinator::COLUMN) return false;
+                    auto selector = Selector{};
+                    selector.type = atom(cp.type);
+                    selector.id = atom(cp.id);
+                    selector.combinator = static_cast<Combinator>(cp.combinator);
+                    for (auto i = cp.firstClass; i < cp.firstClass + cp.classCount; ++i) selector.classes.push_back(atom(lists[i]));
+                    for (auto i = cp.firstAttribute; i < cp.firstAttribute + cp.attributeCount; ++i) selector.attributes.emplace_back(string(lists[i]));
+                    for (auto i = cp.firstPseudoClass; i < cp.firstPseudoClass + cp.pseudoClassCount; ++i) selector.pseudoclasses.emplace_back(string(lists[i]));
+                    complex.push_back(std::move(selector));
+                }
+                try
+                {
+                    rule.selectors.emplace_back(cx.specificity, std::move(complex));
+                }
+                catch (std::exception const &)
+                {
+                    return false; // a selector the parser would have rejected
+                }
+            }
+            for (auto d = record.firstDeclaration; d < record.firstDeclaration + record.declarationCount; ++d)
+            {
+                auto const & decl = declarations[d];
+                auto const prop = FindProperty(string(decl.prop));
+                if (!prop || IsShorthand(prop.value())) return false;
+                auto property = Property{ string(decl.value), decl.line, decl.col };
+                property.m_important = decl.important != 0;
+                if (!DecodeValue(decl, string, property.m_typed)) return false;
+                rule.styles.Set(prop.value(), std::move(property));
+            }
+            loaded.push_back(std::move(rule));
+        }
+        if (!ok) return false;
+
+        rules.insert(rules.end(), std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.end()));
+        return true;
+    }
+
+    void LoadEmbeddedRules(EmbeddedStyleSheet const & sheet, std::vector<Rule> & rules)
+    {
+        auto const data = std::string_view{ reinterpret_cast<char const *>(sheet.data), sheet.size };
+        auto const first = rules.size();
+        if (!DeserializeRules(data, mxi::hash_bytes(sheet.source), rules))
+        {
+            MX_THROW(std::format("Embedded stylesheet {} does not match this build; rerun jassgen", sheet.name));
+        }
+
+#ifdef _DEBUG
+        // The embedded rules must be exactly what parsing the source now would give
+        auto parsed = std::vector<Rule>{};
+        JassParser{ sheet.source, parsed };
+        auto const hash = mxi::hash_bytes(sheet.source);
+        if (SerializeRules(hash, parsed) != SerializeRules(hash, rules, first))
+        {
+            MX_THROW(std::format("Embedded stylesheet {} differs from its parsed source; rerun jassgen", sheet.name));
+        }
+#endif
+        MX_LOG_DEBUG(std::format("Attached {} embedded rules from {}", rules.size() - first, sheet.name));
+    }
+
+    void LoadRules(std::string_view const & source, std::filesystem::path const & cachePath, std::vector<Rule> & rules)
+    {
+        auto const started = std::chrono::steady_clock::now();
+        auto const elapsed = [&]()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        };
+
+        auto const hash = mxi::hash_bytes(source);
+        auto const first = rules.size();
+        if (ReadCompiled(cachePath, hash, rules))
+        {
+            MX_LOG_DEBUG(std::format("Loaded {} rules from {} in {}us", rules.size() - first, cachePath.string(), elapsed()));
+            return;
+        }
+
+        JassParser{ source, rules };
+        MX_LOG_DEBUG(std::format("Parsed {} rules for {} in {}us", rules.size() - first, cachePath.string(), elapsed()));
+
+        try
+        {
+            WriteCompiled(cachePath, hash, rules, first);
+        }
+        catch (std::exception const & err)
+        {
+            MX_LOG_WARN(err.what());
+        }
+    }
+
+    StyleSheet::StyleSheet(std::string_view const & name, std::string_view const & source, std::filesystem::path const & cachePath)
+        : m_name(name), m_sourceHash(mxi::hash_bytes(source))
+    {
+        if (cachePath.empty()) JassParser{ source, m_rules };
+        else LoadRules(source, cachePath, m_rules);
+        Build();
+    }
+
+    StyleSheet::StyleSheet(EmbeddedStyleSheet const & embedded)
+        : m_name(embedded.name), m_sourceHash(mxi::hash_bytes(embedded.source)), m_embedded(true)
+    {
+        LoadEmbeddedRules(embedded, m_rules);
+        Build();
+    }
+
+    StyleSheet::StyleSheet(std::string_view const & name, uint64_t const sourceHash, std::string_view const & compiled)
+        : m_name(name), m_sourceHash(sourceHash)
+    {
+        if (!DeserializeRules(compiled, sourceHash, m_rules)) MX_THROW(std::format("Compiled rules for {} are stale or corrupt", name));
+        Build();
+    }
+
+    void StyleSheet::Build()
+    {
+        m_index.Build(m_rules);
+        m_invalidationSets.Build(m_rules);
+    }
+
+    namespace
+    {
+        // Sheets currently held by some window, keyed by canonical path (or embedded name).
+        class SheetCacheEntry
+        {
+        public:
+            std::filesystem::file_time_type modified = {};
+            uint64_t sourceHash = 0;
+            std::weak_ptr<StyleSheet const> sheet = {};
+        };
+
+        std::mutex sheetCacheMutex;
+        std::unordered_map<std::string, SheetCacheEntry> sheetCache;
+
+        // The entry for key, or nullptr. Call with sheetCacheMutex held.
+        SheetCacheEntry * FindCacheEntry(std::string const & key)
+        {
+            auto const found = sheetCache.find(key);
+            return (found != sheetCache.end()) ? &found->second : nullptr;
+        }
+
+        // The entry for key, after dropping every entry whose sheet no window holds any more, so that the cache
+        // does not keep one for every sheet ever loaded. Call with sheetCacheMutex held.
+        SheetCacheEntry & InsertCacheEntry(std::string const & key)
+        {
+            std::erase_if(sheetCache, [](auto const & item) { return item.second.sheet.expired(); });
+            return sheetCache[key];
+        }
+    }
+
+    std::shared_ptr<StyleSheet const> StyleSheet::Load(std::filesystem::path const & path)
+    {
+        auto const canonical = std::filesystem::canonical(path);
+        auto const key = canonical.string();
+        auto const modified = std::filesystem::last_write_time(canonical);
+        {
+            // An unchanged timestamp means an unchanged file, without reading it
+            auto const lock = std::scoped_lock{ sheetCacheMutex };
+            auto const entry = FindCacheEntry(key);
+            auto const sheet = entry ? entry->sheet.lock() : nullptr;
+            if (sheet && entry->modified == modified) return sheet;
+        }
+
+        auto const source = mxi::file_get_contents(canonical);
+        auto const hash = mxi::hash_bytes(source);
+        {
+            auto const lock = std::scoped_lock{ sheetCacheMutex };
+            auto const entry = FindCacheEntry(key);
+            auto const sheet = entry ? entry->sheet.lock() : nullptr;
+            if (sheet && entry->sourceHash == hash)
+            {
+                entry->modified = modified;
+                return sheet;
+            }
+        }
+
+        // Parsed without the lock held, so other sheets load meanwhile
+        auto parsed = std::make_shared<StyleSheet>(key, source, GetCompiledPath(canonical));
+        parsed->m_path = canonical;
+        auto sheet = std::shared_ptr<StyleSheet const>{ std::move(parsed) };
+
+        auto const lock = std::scoped_lock{ sheetCacheMutex };
+        auto & entry = InsertCacheEntry(key);
+        auto const current = entry.sheet.lock();
+        if (current && entry.sourceHash == hash) return current; // another thread got there first
+        entry.sheet = sheet;
+        entry.sourceHash = hash;
+        entry.modified = modified;
+        return sheet;
+    }
+
+    std::vector<std::shared_ptr<StyleSheet const>> StyleSheet::LoadAll(std::span<std::filesystem::path const> const paths)
+    {
+        auto sheets = std::vector<std::shared_ptr<StyleSheet const>>(paths.size());
+        mxi::parallel_for(paths.size(), [&](size_t const n) { sheets[n] = Load(paths[n]); });
+        return sheets;
+    }
+
+    std::shared_ptr<StyleSheet const> StyleSheet::Load(EmbeddedStyleSheet const & embedded)
+    {
+        auto const lock = std::scoped_lock{ sheetCacheMutex };
+        auto & entry = InsertCacheEntry(std::format("<embedded>{}", embedded.name));
+        auto sheet = entry.sheet.lock();
+        if (sheet) return sheet;
+        sheet = std::make_shared<StyleSheet const>(embedded);
+        entry.sheet = sheet;
+        return sheet;
+    }
+
+    void RuleProfiler::Retain(std::vector<std::shared_ptr<StyleSheet const>> const & sheets)
+    {
+        for (auto const & sheet : sheets)
+        {
+            if (std::find(m_sheets.begin(), m_sheets.end(), sheet) == m_sheets.end()) m_sheets.push_back(sheet);
+        }
+    }
+
+    void RuleProfiler::RecordAttempt(Rule const & rule, bool const matched, uint64_t const nanoseconds)
+    {
+        auto & counters = m_counters[&rule];
+        ++counters.attempts;
+        if (matched) ++counters.matches;
+        counters.nanoseconds += nanoseconds;
+    }
+
+    std::string RuleProfiler::Report(std::vector<std::shared_ptr<StyleSheet const>> const & sheets, Format const format) const
+    {
+        auto out = std::string{ (format == JSON) ? "[" : "sheet,line,col,attempts,matches,filtered,nanoseconds,never_matched\n" };
+        auto first = true;
+        for (auto const & sheet : sheets)
+        {
+            auto name = sheet->GetName();
+            if (format == JSON) mxi::json_escape_string(name);
+            else
+            {
+                // CSV quotes are doubled
+                for (size_t n = name.find('"'); n != std::string::npos; n = name.find('"', n + 2)) name.insert(n, 1, '"');
+            }
+
+            for (auto const & rule : sheet->GetRules())
+            {
+                auto const found = m_counters.find(&rule);
+                auto const counters = (found == m_counters.end()) ? Counters{} : found->second;
+                auto const never = counters.matches == 0;
+                if (format == JSON)
+                {
+                    out.append(std::format("{}\n  {{\"sheet\":\"{}\",\"line\":{},\"col\":{},\"attempts\":{},\"matches\":{},\"filtered\":{},\"nanoseconds\":{},\"neverMatched\":{}}}",
+                        first ? "" : ",", name, rule.m_line, rule.m_col, counters.attempts, counters.matches, counters.filtered, counters.nanoseconds, never));
+                }
+                else
+                {
+                    out.append(std::format("\"{}\",{},{},{},{},{},{},{}\n",
+                        name, rule.m_line, rule.m_col, counters.attempts, counters.matches, counters.filtered, counters.nanoseconds, never ? 1 : 0));
+                }
+                first = false;
+            }
+        }
+        if (format == JSON) out.append("\n]\n");
+        return out;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "jass.h"
+
+namespace jass
+{
+    // Compiled stylesheets: a flat, position-independent binary form of std::vector<Rule> holding a
+    // string table, rules, complex selectors, compound selectors and declarations as arrays of plain
+    // records. It is keyed by a hash of the source text so a stale file is simply ignored.
+
+    // A stylesheet compiled into the executable by tools/jassgen. data is the compiled form of source.
+    class EmbeddedStyleSheet
+    {
+    public:
+        char const * name;
+        std::string_view source;
+        unsigned char const * data; // 8-byte aligned
+        size_t size;
+    };
+
+    // Path of the compiled form of a stylesheet file (or of the nth <style> block in a document).
+    std::filesystem::path GetCompiledPath(std::filesystem::path const & source, size_t const n = -1ULL);
+
+    // Append rules from a memory-mapped compiled file. Returns false (leaving rules untouched) if the
+    // file is missing, malformed or was compiled from a source with a different hash.
+    bool ReadCompiled(std::filesystem::path const & path, uint64_t const sourceHash, std::vector<Rule> & rules);
+
+    // Append rules from compiled data in memory. data must be 8-byte aligned.
+    bool DeserializeRules(std::string_view const & data, uint64_t const sourceHash, std::vector<Rule> & rules);
+
+    // Write rules[first..] to a compiled file.
+    void WriteCompiled(std::filesystem::path const & path, uint64_t const sourceHash, std::vector<Rule> const & rules, size_t const first = 0);
+
+    // The compiled form of rules[first..], as written by WriteCompiled.
+    std::string SerializeRules(uint64_t const sourceHash, std::vector<Rule> const & rules, size_t const first = 0);
+
+    // Append the rules of an embedded stylesheet without parsing it. Throws if it was generated by a build with a
+    // different compiled format; debug builds also check that it still matches its parsed source.
+    void LoadEmbeddedRules(EmbeddedStyleSheet const & sheet, std::vector<Rule> & rules);
+
+    // Append rules for source, loading them from the compiled file at cachePath when it is current
+    // and otherwise parsing source and (re)writing the compiled file.
+    void LoadRules(std::string_view const & source, std::filesystem::path const & cachePath, std::vector<Rule> & rules);
+
+    // An immutable stylesheet with its rule index and invalidation sets built. Windows share them through Load, so
+    // a sheet used by several windows is parsed and indexed once per process.
+    class StyleSheet
+    {
+    public:
+        // Parse source, or load its compiled form from cachePath when that is given and current. name identifies
+        // the sheet in diagnostics.
+        StyleSheet(std::string_view const & name, std::string_view const & source, std::filesystem::path const & cachePath = {});
+        explicit StyleSheet(EmbeddedStyleSheet const & embedded);
+        StyleSheet(StyleSheet const &) = delete;
+
+        // From rules in compiled form, e.g. saved in a window snapshot. Throws unless they were compiled from a
+        // source with this hash by this build's compiled format.
+        StyleSheet(std::string_view const & name, uint64_t const sourceHash, std::string_view const & compiled);
+
+        // The sheet for a file, shared while any window holds it and the file's contents are unchanged.
+        static std::shared_ptr<StyleSheet const> Load(std::filesystem::path const & path);
+        static std::shared_ptr<StyleSheet const> Load(EmbeddedStyleSheet const & embedded);
+
+        // Load each file as Load does, parsing them in parallel. The result is in the order of paths.
+        static std::vector<std::shared_ptr<StyleSheet const>> LoadAll(std::span<std::filesystem::path const> const paths);
+
+        std::string const & GetName() const noexcept { return m_name; }
+        uint64_t GetSourceHash() const noexcept { return m_sourceHash; } // mxi::hash_bytes of the source text
+        std::filesystem::path const & GetPath() const noexcept { return m_path; } // empty unless loaded from a file
+        bool IsEmbedded() const noexcept { return m_embedded; }
+        std::vector<Rule> const & GetRules() const noexcept { return m_rules; }
+        RuleIndex const & GetIndex() const noexcept { return m_index; }
+        InvalidationSets const & GetInvalidationSets() const noexcept { return m_invalidationSets; }
+
+    private:
+        void Build();
+        std::string m_name;
+        uint64_t m_sourceHash = 0;
+        std::filesystem::path m_path = {}; // set by Load
+        bool m_embedded = false;
+        std::vector<Rule> m_rules = {};
+        RuleIndex m_index = {}; // points into m_rules
+        InvalidationSets m_invalidationSets = {};
+    };
+
+    // Opt-in cost accounting for the cascade: for each rule, how many of its selectors were tried against an
+    // element, how many matched, how many the ancestor filter rejected, and the time spent matching.
+    class RuleProfiler
+    {
+    public:
+        class Counters
+        {
+        public:
+            uint64_t attempts = 0;
+            uint64_t matches = 0;
+            uint64_t filtered = 0; // rejected by the ancestor filter without matching
+            uint64_t nanoseconds = 0;
+        };
+
+        enum Format
+        {
+            JSON, CSV
+        };
+
+        // Rules are counted by address, so the sheets they belong to must be retained for as long as the profiler,
+        // lest a freed sheet's addresses be reused by another's rules. Call whenever the sheets in use change.
+        void Retain(std::vector<std::shared_ptr<StyleSheet const>> const & sheets);
+        void RecordFiltered(Rule const & rule) { ++m_counters[&rule].filtered; }
+        void RecordAttempt(Rule const & rule, bool const matched, uint64_t const nanoseconds);
+        void Clear() { m_counters.clear(); }
+
+        // One row per rule of sheets, in cascade order, including rules never tried. Rules that never matched are
+        // flagged, as candidates for pruning.
+        std::string Report(std::vector<std::shared_ptr<StyleSheet const>> const & sheets, Format const format) const;
+
+    private:
+        std::unordered_map<Rule const *, Counters> m_counters = {}; // into m_sheets
+        std::vector<std::shared_ptr<StyleSheet const>> m_sheets = {};
+    };
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+// jassgen: compiles a stylesheet at build time into a header that embeds its rules, so the application can
+// attach them with jass::LoadEmbeddedRules instead of parsing them at startup.
+//
+//     jassgen <input.jass> <output.h> <Name>
+//
+// The header defines jass::embedded::k<Name>, an EmbeddedStyleSheet. It is only rewritten when its
+// contents change, so an unchanged stylesheet does not trigger a rebuild.
+
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "MxiUtils.h"
+
+#include "jass.h"
+#include "jassc.h"
+
+namespace
+{
+    void AppendBytes(std::string & out, std::string_view const & bytes)
+    {
+        for (size_t n = 0; n < bytes.size(); ++n)
+        {
+            if (n % 16 == 0) out.append(n ? "\n        " : "        ");
+            out.append(std::format("0x{:02X}, ", static_cast<unsigned char>(bytes[n])));
+        }
+        out.append("\n");
+    }
+
+    std::string Generate(std::filesystem::path const & input, std::string_view const & name)
+    {
+        auto const source = mxi::file_get_contents(input);
+        auto rules = std::vector<jass::Rule>{};
+        jass::JassParser{ source, rules };
+        auto const compiled = jass::SerializeRules(mxi::hash_bytes(source), rules);
+
+        auto out = std::format("// Generated by jassgen from {}; do not edit.\n\n", input.filename().string());
+        out.append("#pragma once\n\n#include \"jassc.h\"\n\nnamespace jass::embedded\n{\n");
+        out.append(std::format("    alignas(8) inline constexpr unsigned char k{}Data[] =\n    {{\n", name));
+        AppendBytes(out, compiled);
+        out.append("    };\n\n");
+        out.append(std::format("    inline constexpr char k{}Source[] =\n    {{\n", name));
+        AppendBytes(out, source);
+        out.append("        0\n    };\n\n");
+        out.append(std::format("    inline constexpr EmbeddedStyleSheet k{0} = {{ \"{1}\", {{ k{0}Source, sizeof(k{0}Source) - 1 }}, k{0}Data, sizeof(k{0}Data) }};\n",
+            name, input.filename().string()));
+        out.append("}");
+        return out;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc != 4)
+    {
+        std::cerr << "Usage: jassgen <input.jass> <output.h> <Name>" << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        auto const output = std::filesystem::path{ argv[2] };
+        auto const header = Generate(argv[1], argv[3]);
+        if (std::filesystem::exists(output) && mxi::file_get_contents(output) == header) return 0;
+
+        auto file = std::ofstream{ output, std::ios::binary | std::ios::trunc };
+        if (!file) MX_THROW(std::format("Unable to write {}", output.string()));
+        file << header;
+        return 0;
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << argv[1] << ": " << e.what() << std::endl;
+        return 1;
+    }
+}